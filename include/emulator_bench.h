@@ -0,0 +1,28 @@
+#pragma once
+
+#ifndef EMULATOR_BENCH_H
+#define EMULATOR_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// where host time is charged while benchmarking
+enum {
+  EMU_BENCH_OTHER,
+  EMU_BENCH_CPU,
+  EMU_BENCH_RENDER,
+  EMU_BENCH_AUDIO,
+  EMU_BENCH_DEVICE,
+  EMU_BENCH_MAX,
+};
+
+bool emulatorBenchInit(void);
+void emulatorBenchStart(void);
+bool emulatorBenchEnabled(void);
+bool emulatorBenchDone(void);
+void emulatorBenchFrame(void);
+int emulatorBenchSwitch(int bucket);
+
+extern uint64_t emulatorInstructions;
+
+#endif /* EMULATOR_BENCH_H */
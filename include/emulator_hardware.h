@@ -7,6 +7,8 @@
 
 #include <stdint.h>
 
+#include "emulator_snapshot.h"
+
 #ifndef EMULATOR_HARDWARE_H
 #define EMULATOR_HARDWARE_H
 
@@ -130,6 +132,13 @@ void qsoundWrite(Uint32 address, Uint8 val);
 extern bool qsound_enabled;
 extern Uint32 qsound_addr;
 
+/* qlay QL-SD block transfers done by the emulator */
+void qlayInitialiseQLSDHle(void);
+
+/* snapshot the machine's registers */
+void emulatorHardwareSnapshotSave(emulator_snapshot_t* snap);
+void emulatorHardwareSnapshotLoad(emulator_snapshot_t* snap);
+
 /* Shadow registers */
 extern uint8_t EMU_PC_INTR;
 extern uint8_t EMU_PC_INTR_MASK;
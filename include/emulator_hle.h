@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef EMULATOR_HLE_H
+#define EMULATOR_HLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * High level replacements for guest subroutines. Entries are given per
+ * ROM as addr:op:unit:reg,reg where addr is an address or trace-map
+ * symbol of the subroutine entry, op one of the machine's operations,
+ * unit the device it drives and the registers its arguments, eg
+ * spi-hle = spi_rdblk:read:1:a1,d2. When the CPU reaches the entry the
+ * operation runs in one step and the subroutine returns.
+ */
+#define EMU_HLE_REGS 4
+
+typedef struct emulator_hle emulator_hle_t;
+// returns false to leave the guest code to run
+typedef bool (*emulator_hle_fn)(const emulator_hle_t* hle);
+
+struct emulator_hle {
+  unsigned int pc;
+  int op;
+  int unit;
+  int regs[EMU_HLE_REGS]; // M68K_REG_D0 ...
+  int regCount;
+  emulator_hle_fn fn;
+};
+
+extern bool emulatorHleActive;
+
+// ops is a NULL terminated list of names, an entry's op is its index
+void emulatorHleInit(const char* option, const char* const* ops,
+    emulator_hle_fn fn);
+// an entry the machine found itself, eg from a ROM vector table
+void emulatorHleAdd(const char* option, const char* const* ops,
+    const emulator_hle_t* hle);
+bool emulatorHleHook(unsigned int pc);
+
+// helpers for the operations
+uint32_t emulatorHleReg(const emulator_hle_t* hle, int arg);
+void emulatorHleSetReg(const emulator_hle_t* hle, int arg, uint32_t val);
+void emulatorHleReturn(unsigned int skip);
+
+#endif /* EMULATOR_HLE_H */
@@ -0,0 +1,14 @@
+#pragma once
+
+#ifndef EMULATOR_IDLE_H
+#define EMULATOR_IDLE_H
+
+#include <stdbool.h>
+
+void emulatorIdleInit(void);
+void emulatorIdleHook(unsigned int pc);
+bool emulatorIdleTake(void);
+
+extern bool emulatorIdleDetect;
+
+#endif /* EMULATOR_IDLE_H */
@@ -5,6 +5,10 @@
 
 #include <stdbool.h>
 
+#include "emulator_snapshot.h"
+
 void emulatorProcessKey(int keysym, int scancode, bool pressed);
+void emulatorKeyboardSnapshotSave(emulator_snapshot_t* snap);
+void emulatorKeyboardSnapshotLoad(emulator_snapshot_t* snap);
 
 #endif /* EMULATOR_KEYBOARD_H */
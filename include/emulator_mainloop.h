@@ -8,6 +8,7 @@
 
 uint64_t cycles(void);
 void* emulatorInitEmulation(void);
+void emulatorExitEmulation(void);
 bool emulatorInteration(void* state);
 
 extern unsigned int extraCycles;
@@ -5,10 +5,56 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The address space is split into 64K pages, pages of plain RAM/ROM hold
+ * a host pointer to the page base so the CPU can access them directly.
+ * A NULL pointer sends the access down the machine's full address decode
+ * which handles IO, protection and unmapped space.
+ */
+#define EMU_PAGE_SHIFT 16
+#define EMU_PAGE_SIZE (1UL << EMU_PAGE_SHIFT)
+#define EMU_PAGE_MASK (EMU_PAGE_SIZE - 1)
+#define EMU_PAGE_COUNT (1UL << (32 - EMU_PAGE_SHIFT))
+
+typedef struct {
+  const uint8_t* read;
+  uint8_t* write;
+  uint32_t* dirty; // this page's part of the screen dirty map or NULL
+  unsigned int wait; // contention cycles per byte access
+} emulator_page_t;
+
+extern emulator_page_t emulatorPages[EMU_PAGE_COUNT];
+
+// bumped by every CPU write, lets idle detection spot loops that store
+extern uint32_t emulatorWriteCount;
+
+/*
+ * Screen memory is tracked for changes in 128 byte chunks, one QL mode 4
+ * scanline. The map covers the QL screens at 0x20000 followed by the
+ * Q68 high resolution screen.
+ */
+#define EMU_DIRTY_SHIFT 7
+#define EMU_DIRTY_QL 0
+#define EMU_DIRTY_Q68 (EMU_PAGE_SIZE >> EMU_DIRTY_SHIFT)
+#define EMU_DIRTY_CHUNKS (EMU_DIRTY_Q68 + (Q68_SCREEN_SIZE >> EMU_DIRTY_SHIFT))
+#define EMU_DIRTY_PAGE_WORDS ((EMU_PAGE_SIZE >> EMU_DIRTY_SHIFT) / 32)
+
+#define EMU_PAGE_MARK_DIRTY(page, offset) \
+  ((page)->dirty[(offset) >> (EMU_DIRTY_SHIFT + 5)] |= 1U << (((offset) >> EMU_DIRTY_SHIFT) & 31))
+
+// copy blocks between device buffers and the guest address space, the
+// result is the contention cycles the CPU would have waited for
+unsigned int emulatorMemoryRead(uint32_t address, void* data, size_t size);
+unsigned int emulatorMemoryWrite(uint32_t address, const void* data,
+    size_t size);
 
 uint8_t* emulatorMemorySpace(void);
 uint8_t* emulatorScreenSpace(void);
+size_t emulatorMemorySize(void);
 int emulatorInitMemory(void);
+void emulatorMemoryMapUpdate(void);
 extern bool romProtect;
 
 #define KB(x) ((size_t)(x) << 10)
@@ -29,6 +75,8 @@ extern bool romProtect;
 #define Q68_SCREEN 0xFE800000
 #define Q68_SCREEN_SIZE MB(4)
 
+extern uint32_t emulatorScreenDirty[EMU_DIRTY_CHUNKS / 32];
+
 #define Q68_Q40_IO 0xFF000000
 #define Q68_Q40_IO_SIZE MB(16)
 
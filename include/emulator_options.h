@@ -15,6 +15,9 @@ int emulatorOptionDevCount(const char* name);
 const char* emulatorOptionDev(const char* name, int idx);
 int emulatorOptionArgc(void);
 const char* emulatorOptionArgv(int idx);
+void emulatorOptionForEach(void (*fn)(const char* name, const char* value,
+                               void* user),
+    void* user);
 
 #ifdef __cplusplus
 };
@@ -14,13 +14,18 @@
 #endif
 
 int emulatorInitScreen(int screenMode);
+void emulatorQuitScreen(void);
 void emulatorUpdatePixelBuffer(void);
 void emulatorRenderScreen(void);
 void emulatorScreenChangeMode(int qlMode);
+void emulatorScreenRedraw(void);
 void emulatorToggleFullScreen(void);
 void emulatorSetRefresh(bool fast);
 void emulatorToggleRefresh(void);
+bool emulatorScreenSetPalette(int palette);
+void emulatorTogglePalette(void);
 
 extern bool emulatorSecondScreen;
+extern int emulatorCurrentMode;
 
 #endif /* EMULATOR_SCREEN_H */
@@ -0,0 +1,45 @@
+#pragma once
+
+#ifndef EMULATOR_SDIMAGE_H
+#define EMULATOR_SDIMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SD_IMAGE_SECTOR 512
+
+typedef struct emulator_sdimage emulator_sdimage_t;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t writebacks;
+} emulator_sdimage_stats_t;
+
+emulator_sdimage_t* sdImageOpen(const char* file, const char* overlay);
+void sdImageClose(emulator_sdimage_t* img);
+void sdImageCloseAll(void);
+
+// byte offsets and sizes, partial sectors are read and merged
+bool sdImageRead(emulator_sdimage_t* img, uint64_t offset, void* data,
+    size_t size);
+bool sdImageWrite(emulator_sdimage_t* img, uint64_t offset,
+    const void* data, size_t size);
+void sdImagePrefetch(emulator_sdimage_t* img, uint64_t offset, size_t size);
+// erase a range, freeing the host space behind it where possible
+bool sdImageTrim(emulator_sdimage_t* img, uint64_t offset, uint64_t size);
+uint64_t sdImageSectors(emulator_sdimage_t* img);
+bool sdImagePunchHole(const char* file, uint64_t offset, uint64_t size);
+// false while the sd-async I/O thread has yet to bring in part of the range
+bool sdImageReady(emulator_sdimage_t* img, uint64_t offset, size_t size);
+
+// write back dirty sectors, mapped images follow the sd-msync policy
+bool sdImageFlush(emulator_sdimage_t* img);
+void sdImageFlushAll(void);
+// write back everything whatever the policy
+void sdImageSyncAll(void);
+
+void sdImageStats(emulator_sdimage_stats_t* stats);
+
+#endif /* EMULATOR_SDIMAGE_H */
@@ -0,0 +1,31 @@
+#pragma once
+
+#ifndef EMULATOR_SDOVERLAY_H
+#define EMULATOR_SDOVERLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct emulator_sdoverlay emulator_sdoverlay_t;
+
+// the base image is only ever read, the delta is created when missing
+emulator_sdoverlay_t* sdOverlayOpen(const char* base, const char* delta);
+void sdOverlayClose(emulator_sdoverlay_t* ov);
+uint64_t sdOverlaySectors(emulator_sdoverlay_t* ov);
+
+// whole SD_IMAGE_SECTOR sectors only
+bool sdOverlayRead(emulator_sdoverlay_t* ov, uint64_t sector, void* data,
+    size_t count);
+bool sdOverlayWrite(emulator_sdoverlay_t* ov, uint64_t sector,
+    const void* data, size_t count);
+// sectors read from the base again, slots left empty are freed
+bool sdOverlayTrim(emulator_sdoverlay_t* ov, uint64_t sector, size_t count);
+// write out the bitmap and index changed since the last flush
+bool sdOverlayFlush(emulator_sdoverlay_t* ov);
+
+// copy the delta into the base, then empty it
+bool sdOverlayCommit(emulator_sdoverlay_t* ov);
+bool sdOverlayDiscard(emulator_sdoverlay_t* ov);
+
+#endif /* EMULATOR_SDOVERLAY_H */
@@ -0,0 +1,80 @@
+#pragma once
+
+#ifndef EMULATOR_SNAPSHOT_H
+#define EMULATOR_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A snapshot is a small header followed by tagged chunks, each module
+ * writes its own chunk and reads it back by tag so chunks may appear in
+ * any order and unknown ones are skipped. All values are little endian.
+ */
+#define EMU_SNAP_TAG(a, b, c, d) \
+  ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define EMU_SNAP_CPU EMU_SNAP_TAG('C', 'P', 'U', ' ')
+#define EMU_SNAP_RAM EMU_SNAP_TAG('R', 'A', 'M', ' ')
+#define EMU_SNAP_SCREEN EMU_SNAP_TAG('S', 'C', 'R', 'N')
+#define EMU_SNAP_HW EMU_SNAP_TAG('H', 'W', ' ', ' ')
+#define EMU_SNAP_IPC EMU_SNAP_TAG('I', 'P', 'C', ' ')
+#define EMU_SNAP_MDV EMU_SNAP_TAG('M', 'D', 'V', ' ')
+#define EMU_SNAP_KEYBOARD EMU_SNAP_TAG('K', 'E', 'Y', 'B')
+#define EMU_SNAP_SCHEDULER EMU_SNAP_TAG('S', 'C', 'H', 'D')
+#define EMU_SNAP_SDCARD EMU_SNAP_TAG('S', 'D', 'C', ' ')
+#define EMU_SNAP_MACHINE EMU_SNAP_TAG('M', 'A', 'C', 'H')
+#define EMU_SNAP_DISPLAY EMU_SNAP_TAG('D', 'I', 'S', 'P')
+#define EMU_SNAP_BOOT EMU_SNAP_TAG('B', 'O', 'O', 'T')
+
+typedef struct emulator_snapshot emulator_snapshot_t;
+
+bool emulatorSnapshotSave(const char* file);
+bool emulatorSnapshotLoad(const char* file);
+const char* emulatorSnapshotFile(void);
+
+// boot snapshots, taken once after boot and restored on later starts
+extern bool emulatorBootCapture;
+
+void emulatorBootSnapshotInit(void);
+bool emulatorBootSnapshotPending(void);
+bool emulatorBootSnapshotRestore(void);
+void emulatorBootSnapshotHook(unsigned int pc);
+void emulatorBootSnapshotFrame(void);
+void emulatorBootSnapshotPoll(void);
+
+// writing, chunks are written straight to the stream
+void emulatorSnapshotBegin(emulator_snapshot_t* snap, uint32_t tag);
+void emulatorSnapshotEnd(emulator_snapshot_t* snap);
+void emulatorSnapshotPut8(emulator_snapshot_t* snap, uint8_t val);
+void emulatorSnapshotPut16(emulator_snapshot_t* snap, uint16_t val);
+void emulatorSnapshotPut32(emulator_snapshot_t* snap, uint32_t val);
+void emulatorSnapshotPut64(emulator_snapshot_t* snap, uint64_t val);
+void emulatorSnapshotPutBytes(emulator_snapshot_t* snap, const void* data,
+    size_t size);
+void emulatorSnapshotPutRegion(emulator_snapshot_t* snap,
+    const uint8_t* mem, size_t size);
+
+// reading, getters return zero and fail the load once a chunk runs out
+bool emulatorSnapshotFind(emulator_snapshot_t* snap, uint32_t tag);
+uint8_t emulatorSnapshotGet8(emulator_snapshot_t* snap);
+uint16_t emulatorSnapshotGet16(emulator_snapshot_t* snap);
+uint32_t emulatorSnapshotGet32(emulator_snapshot_t* snap);
+uint64_t emulatorSnapshotGet64(emulator_snapshot_t* snap);
+void emulatorSnapshotGetBytes(emulator_snapshot_t* snap, void* data,
+    size_t size);
+void emulatorSnapshotGetRegion(emulator_snapshot_t* snap, uint8_t* mem,
+    size_t size);
+void emulatorSnapshotFail(emulator_snapshot_t* snap, const char* what);
+bool emulatorSnapshotFailed(emulator_snapshot_t* snap);
+
+// the 68000 registers
+void emulatorSnapshotSaveCpu(emulator_snapshot_t* snap);
+void emulatorSnapshotLoadCpu(emulator_snapshot_t* snap);
+
+// implemented by each machine's main loop
+void emulatorMachineSave(emulator_snapshot_t* snap);
+void emulatorMachineLoad(emulator_snapshot_t* snap);
+
+#endif /* EMULATOR_SNAPSHOT_H */
@@ -4,9 +4,11 @@
 #define EMULATOR_TRACE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 void emulatorTraceInit(void);
 void emulatorTraceToggle(void);
 void emulatorTrace(void);
+bool emulatorTraceLookup(const char* name, unsigned int* addr);
 
 #endif // EMULATOR_TRACE_H
@@ -5,14 +5,20 @@
 
 #include <stdint.h>
 
+#include "emulator_snapshot.h"
+
 void qlayInitIPC(void);
 void wrZX8302(uint8_t data);
 void wr8049(uint8_t data);
 uint8_t readQLHw(uint32_t addr);
 void wrmdvcntl(uint8_t data);
 void writeMdvSer(uint8_t data);
-void do_next_event(void);
 void do_mdv_tick(void);
+void qlayInitMdvHle(void);
+void qlayMdvIdle(void);
+void qlayMdvQuit(void);
+void qlayIPCSnapshotSave(emulator_snapshot_t* snap);
+void qlayIPCSnapshotLoad(emulator_snapshot_t* snap);
 
 extern bool qlayIPCBeeping;
 
@@ -0,0 +1,39 @@
+#pragma once
+
+#ifndef QLAY_SCHEDULER_H
+#define QLAY_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "emulator_snapshot.h"
+
+#define QLAY_CPU_CLOCK 7500000
+#define QLAY_FRAME_CYCLES (QLAY_CPU_CLOCK / 50)
+#define QLAY_RTC_CYCLES QLAY_CPU_CLOCK
+#define QLAY_MDV_CYCLES 230
+
+// Events are dispatched in this order when they fall due on the same cycle
+typedef enum {
+  QLAY_EVENT_FRAME,
+  QLAY_EVENT_RTC,
+  QLAY_EVENT_MDV,
+  QLAY_EVENT_SERTX,
+  QLAY_EVENT_MAX,
+} qlay_event_t;
+
+typedef void (*qlay_event_handler_t)(void);
+
+void qlaySchedulerInit(void);
+void qlaySchedulerSetHandler(qlay_event_t event, qlay_event_handler_t handler);
+void qlayScheduleEventAt(qlay_event_t event, uint64_t when, uint64_t period);
+void qlayScheduleEvent(qlay_event_t event, uint64_t delay);
+void qlayCancelEvent(qlay_event_t event);
+bool qlayEventPending(qlay_event_t event);
+uint64_t qlaySchedulerNow(void);
+uint64_t qlaySchedulerNextEvent(void);
+void qlaySchedulerRun(void);
+void qlaySchedulerSnapshotSave(emulator_snapshot_t* snap);
+void qlaySchedulerSnapshotLoad(emulator_snapshot_t* snap);
+
+#endif /* QLAY_SCHEDULER_H */
@@ -14,7 +14,12 @@
     Adding the native 4-bit-wide SD interface is also possible; this should be broken up into a base
     SD Card class with SPI and SD frontends in that case.
 
-    Multiple block read/write commands are not supported but would be straightforward to add.
+    Multiple block reads (CMD18) and writes (CMD25) are supported. Images go through the
+    sector cache in emulator_sdimage.c, CMD18 prefetches the following blocks into it in one
+    host read and CMD25 blocks are written back as runs when the card is deselected.
+
+    Erase (CMD32/CMD33/CMD38) trims the image so the host can free the space, CMD9 returns
+    a version 2 CSD giving the capacity of the image.
 
     References:
     https://www.sdcard.org/downloads/pls/ (Physical Layer Simplified Specification)
@@ -42,6 +47,11 @@ static const uint8_t DATA_RESPONSE_OK = 0x05;
 static const uint8_t DATA_RESPONSE_IO_ERROR = 0x0d;
 static const int SPI_DELAY_RESPONSE = 1;
 
+// sequential reads prefetch this many bytes ahead
+#define CARD_RUN_BYTES 32768
+// 0xff bytes sent while a block is read before waiting for it
+#define CARD_READ_POLLS 512
+
 // Handle non Windows
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -51,18 +61,31 @@ typedef struct {
   sd_type m_type;
   sd_state m_state;
   uint8_t m_data[520], m_cmd[6];
-  SDL_IOStream* m_harddisk;
+  emulator_sdimage_t* m_harddisk;
 
   int m_ss, m_in_bit, m_clk_state, m_;
   uint8_t m_in_latch, m_out_latch, m_cur_bit;
   uint16_t m_out_count, m_out_ptr, m_write_ptr, m_blksize;
   uint32_t m_blknext;
   bool m_bACMD;
+
+  // blocks prefetched for sequential reads
+  uint32_t m_ahead_blk, m_ahead_count, m_seq_next;
+
+  bool m_write_multi;
+
+  // block whose data token is held back until the image has it
+  bool m_read_wait;
+  uint32_t m_read_blk;
+  int m_read_polls;
+
+  // CMD32/CMD33 range for CMD38, inclusive
+  uint32_t m_erase_start, m_erase_end;
 } card;
 
 card cards[2];
 
-void card_initialise(SDL_IOStream* sd1, SDL_IOStream* sd2)
+void card_initialise(emulator_sdimage_t* sd1, emulator_sdimage_t* sd2)
 {
   cards[0].m_harddisk = sd1;
   cards[0].m_type = SD_TYPE_HC;
@@ -73,14 +96,14 @@ void card_initialise(SDL_IOStream* sd1, SDL_IOStream* sd2)
   cards[1].m_blksize = 512;
 }
 
-static bool card_seek(int cardno, uint32_t blknext)
+static bool card_write(int cardno, uint32_t blknext, void* data)
 {
-  Sint64 seekPos = (Sint64)cards[cardno].m_blksize * (Sint64)blknext;
+  uint64_t offset = (uint64_t)cards[cardno].m_blksize * blknext;
 
-  Sint64 resSeek = SDL_SeekIO(cards[cardno].m_harddisk, seekPos, SDL_IO_SEEK_SET);
-  if (resSeek < 0) {
-    SDL_LogDebug(Q68_LOG_SD, "SD%.1d: failed to seek %" PRId64,
-        cardno, seekPos);
+  if (!sdImageWrite(cards[cardno].m_harddisk, offset, data,
+          cards[cardno].m_blksize)) {
+    SDL_LogError(Q68_LOG_SD, "SD%.1d: failed to write blk = %" PRIu32,
+        cardno, blknext);
 
     return false;
   }
@@ -88,37 +111,174 @@ static bool card_seek(int cardno, uint32_t blknext)
   return true;
 }
 
-static bool card_write(int cardno, uint32_t blknext, void* data)
+static bool card_read(int cardno, uint32_t blknext, void* data)
 {
-  card_seek(cardno, blknext);
+  uint64_t offset = (uint64_t)cards[cardno].m_blksize * blknext;
 
-  size_t resWrite = SDL_WriteIO(cards[0].m_harddisk, data, cards[cardno].m_blksize);
+  if (!sdImageRead(cards[cardno].m_harddisk, offset, data,
+          cards[cardno].m_blksize)) {
+    SDL_LogError(Q68_LOG_SD, "SD%.1d: failed to read blk = %" PRIu32,
+        cardno, blknext);
+    return false;
+  }
 
-  if (resWrite != cards[cardno].m_blksize) {
-    SDL_LogError(Q68_LOG_SD, "SD%.1d: failed to write %" PRIdMAX,
-        cardno, (intmax_t)resWrite);
+  return true;
+}
+
+// token, block and CRC at m_data[pos], returns the bytes to send
+static uint16_t card_load_block(int cardno, uint32_t blk, uint16_t pos)
+{
+  card* sd = &cards[cardno];
 
-    return 0;
+  sd->m_data[pos] = 0xfe; // data token
+  card_read(cardno, blk, &sd->m_data[pos + 1]);
+  uint16_t crc16 = crc16spi_fujitsu_byte(0, &sd->m_data[pos + 1],
+      sd->m_blksize);
+  sd->m_data[pos + sd->m_blksize + 1] = (crc16 >> 8) & 0xff;
+  sd->m_data[pos + sd->m_blksize + 2] = (crc16 & 0xff);
+
+  return 1 + sd->m_blksize + 2;
+}
+
+// CMD18 and runs of CMD17 keep the next blocks coming into the cache,
+// true when the block can be sent straight away
+static bool card_start_block(int cardno, uint32_t blk, bool multi)
+{
+  card* sd = &cards[cardno];
+  uint32_t run = CARD_RUN_BYTES / sd->m_blksize;
+
+  if (multi || (blk == sd->m_seq_next)) {
+    if ((blk < sd->m_ahead_blk)
+        || (blk >= (sd->m_ahead_blk + sd->m_ahead_count))) {
+      sd->m_ahead_blk = blk;
+      sd->m_ahead_count = run;
+      sdImagePrefetch(sd->m_harddisk, (uint64_t)sd->m_blksize * blk,
+          CARD_RUN_BYTES);
+    } else if ((blk - sd->m_ahead_blk) >= (sd->m_ahead_count - run / 2)) {
+      // half a run from the end, fetch the next one before it is needed
+      sdImagePrefetch(sd->m_harddisk,
+          (uint64_t)sd->m_blksize * (sd->m_ahead_blk + sd->m_ahead_count),
+          CARD_RUN_BYTES);
+      sd->m_ahead_blk += sd->m_ahead_count - run;
+      sd->m_ahead_count = 2 * run;
+    }
+  } else {
+    sdImagePrefetch(sd->m_harddisk, (uint64_t)sd->m_blksize * blk,
+        sd->m_blksize);
+  }
+  sd->m_seq_next = blk + 1;
+
+  if (sdImageReady(sd->m_harddisk, (uint64_t)sd->m_blksize * blk,
+          sd->m_blksize)) {
+    return true;
   }
 
-  return 1;
+  sd->m_read_wait = true;
+  sd->m_read_blk = blk;
+  sd->m_read_polls = 0;
+
+  return false;
 }
 
-static bool card_read(int cardno, uint32_t blknext, void* data)
+// send the waiting block once it has arrived, only stalling the
+// emulation after the host has been kept waiting a while
+static void card_poll_block(int cardno)
 {
-  card_seek(cardno, blknext);
+  card* sd = &cards[cardno];
 
-  ssize_t resRead = SDL_ReadIO(cards[0].m_harddisk, data, cards[0].m_blksize);
+  if (!sdImageReady(sd->m_harddisk, (uint64_t)sd->m_blksize * sd->m_read_blk,
+          sd->m_blksize)
+      && (++sd->m_read_polls < CARD_READ_POLLS)) {
+    return;
+  }
 
-  if (resRead != cards[cardno].m_blksize) {
-    SDL_LogError(Q68_LOG_SD,
-        "SD%.1d: failed to read =  %" PRIdMAX
-        ", blk = %" PRIu32,
-        cardno, (intmax_t)resRead, blknext);
-    return false;
+  send_data(cardno, card_load_block(cardno, sd->m_read_blk, 0), sd->m_state);
+}
+
+// block number argument of a read, write or erase command
+static uint32_t card_arg_block(int cardno)
+{
+  uint32_t blk = ((uint32_t)cards[cardno].m_cmd[1] << 24) | ((uint32_t)cards[cardno].m_cmd[2] << 16) | ((uint32_t)cards[cardno].m_cmd[3] << 8) | (uint32_t)cards[cardno].m_cmd[4];
+
+  if (cards[cardno].m_type == SD_TYPE_V2) {
+    blk /= cards[cardno].m_blksize;
   }
 
-  return true;
+  return blk;
+}
+
+// returns the R1 response for CMD38
+static uint8_t card_erase(int cardno)
+{
+  card* sd = &cards[cardno];
+  uint64_t blocks = (sdImageSectors(sd->m_harddisk) * SD_IMAGE_SECTOR) / sd->m_blksize;
+
+  if (sd->m_erase_start > sd->m_erase_end) {
+    return 0x10; // erase sequence error
+  }
+
+  if (sd->m_erase_end >= blocks) {
+    return 0x20; // address error
+  }
+
+  SDL_LogDebug(Q68_LOG_SD, "SD%.1d: erase blk %" PRIu32 " - %" PRIu32, cardno,
+      sd->m_erase_start, sd->m_erase_end);
+
+  sdImageTrim(sd->m_harddisk, (uint64_t)sd->m_blksize * sd->m_erase_start,
+      (uint64_t)sd->m_blksize * (sd->m_erase_end - sd->m_erase_start + 1));
+
+  return 0;
+}
+
+static uint8_t card_crc7(const uint8_t* data, size_t len)
+{
+  uint8_t crc = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      bool in = ((data[i] >> bit) & 1) ^ ((crc >> 6) & 1);
+
+      crc = (crc << 1) & 0x7f;
+      if (in) {
+        crc ^= 0x09;
+      }
+    }
+  }
+
+  return crc;
+}
+
+// CSD version 2.0 as on an SDHC card, REF 5.3.3
+static void card_csd(int cardno, uint8_t* csd)
+{
+  uint64_t sectors = sdImageSectors(cards[cardno].m_harddisk);
+  // C_SIZE counts 512K units less one
+  uint32_t c_size = SDL_min(SDL_max(sectors / 1024, 1) - 1, 0x3fffff);
+
+  csd[0] = 0x40; // CSD_STRUCTURE 1
+  csd[1] = 0x0e; // TAAC 1ms
+  csd[2] = 0x00; // NSAC
+  csd[3] = 0x32; // TRAN_SPEED 25MHz
+  csd[4] = 0x5b; // CCC including class 5 erase
+  csd[5] = 0x59; // READ_BL_LEN 512
+  csd[6] = 0x00;
+  csd[7] = (c_size >> 16) & 0x3f;
+  csd[8] = (c_size >> 8) & 0xff;
+  csd[9] = c_size & 0xff;
+  csd[10] = 0x7f; // ERASE_BLK_EN, SECTOR_SIZE 0x7f with csd[11]
+  csd[11] = 0x80; // bit 7 ends SECTOR_SIZE, 128 blocks or 64KB
+  csd[12] = 0x0a; // R2W_FACTOR, WRITE_BL_LEN 512
+  csd[13] = 0x40;
+  csd[14] = 0x00;
+  csd[15] = (card_crc7(csd, 15) << 1) | 1;
+}
+
+// write back anything cached for the card once the host lets go of it
+void card_deselect(int cardno)
+{
+  if (cards[cardno].m_harddisk != NULL) {
+    sdImageFlush(cards[cardno].m_harddisk);
+  }
 }
 
 /*
@@ -138,6 +298,8 @@ bool get_card_present(void) {
 */
 void send_data(int cardno, uint16_t count, sd_state new_state)
 {
+  // a new response replaces any block still being waited for
+  cards[cardno].m_read_wait = false;
   cards[cardno].m_out_ptr = 0;
   cards[cardno].m_out_count = count;
   change_state(cardno, new_state);
@@ -197,7 +359,17 @@ void card_byte_in(int cardno, uint8_t m_in_latch)
     break;
 
   case SD_STATE_WRITE_WAITFE:
-    if (m_in_latch == 0xfe) {
+    if (cards[cardno].m_write_multi) {
+      if (m_in_latch == 0xfc) { // CMD25 data token
+        cards[cardno].m_state = SD_STATE_WRITE_DATA;
+        cards[cardno].m_out_latch = 0xff;
+        cards[cardno].m_write_ptr = 0;
+      } else if (m_in_latch == 0xfd) { // CMD25 stop token
+        cards[cardno].m_write_multi = false;
+        cards[cardno].m_out_latch = 0xff;
+        change_state(cardno, SD_STATE_IDLE);
+      }
+    } else if (m_in_latch == 0xfe) {
       cards[cardno].m_state = SD_STATE_WRITE_DATA;
       cards[cardno].m_out_latch = 0xff;
       cards[cardno].m_write_ptr = 0;
@@ -210,7 +382,7 @@ void card_byte_in(int cardno, uint8_t m_in_latch)
       cards[cardno].m_data[cards[cardno].m_write_ptr] = m_in_latch;
     } else {
       SDL_LogError(Q68_LOG_SD, "m_write_ptr overflow %d",
-          (int)cards[0].m_write_ptr);
+          (int)cards[cardno].m_write_ptr);
     }
     cards[cardno].m_write_ptr++;
 
@@ -222,7 +394,7 @@ void card_byte_in(int cardno, uint8_t m_in_latch)
           cards[cardno].m_data[1],
           cards[cardno].m_data[2],
           cards[cardno].m_data[3]);
-      if (card_write(cardno, cards[cardno].m_blknext,
+      if (card_write(cardno, cards[cardno].m_blknext++,
               &cards[cardno].m_data[0])) {
         cards[cardno].m_data[0] = DATA_RESPONSE_OK;
       } else {
@@ -230,23 +402,22 @@ void card_byte_in(int cardno, uint8_t m_in_latch)
       }
       cards[cardno].m_data[1] = 0x01;
 
-      send_data(cardno, 2, SD_STATE_IDLE);
+      // CMD25 waits for the next block or the stop token
+      send_data(cardno, 2,
+          cards[cardno].m_write_multi ? SD_STATE_WRITE_WAITFE : SD_STATE_IDLE);
     }
     break;
 
   case SD_STATE_DATA_MULTI:
     do_command(cardno);
-    if (cards[cardno].m_state == SD_STATE_DATA_MULTI && cards[cardno].m_out_count == 0) {
-      cards[cardno].m_data[0] = 0xfe; // data token
-      card_read(cardno, cards[cardno].m_blknext++,
-          &cards[cardno].m_data[1]);
-      uint16_t crc16 = crc16spi_fujitsu_byte(
-          0, &cards[cardno].m_data[1],
-          cards[cardno].m_blksize);
-      cards[cardno].m_data[cards[cardno].m_blksize + 1] = (crc16 >> 8) & 0xff;
-      cards[cardno].m_data[cards[cardno].m_blksize + 2] = (crc16 & 0xff);
-      send_data(cardno, 1 + cards[cardno].m_blksize + 2,
-          SD_STATE_DATA_MULTI);
+    if (cards[cardno].m_state == SD_STATE_DATA_MULTI && cards[cardno].m_out_count == 0
+        && !cards[cardno].m_read_wait) {
+      uint32_t blk = cards[cardno].m_blknext++;
+
+      if (card_start_block(cardno, blk, true)) {
+        send_data(cardno, card_load_block(cardno, blk, 0),
+            SD_STATE_DATA_MULTI);
+      }
     }
     break;
 
@@ -265,6 +436,10 @@ uint8_t card_byte_out(int cardno)
     return 0xff;
   }
 
+  if ((cards[cardno].m_out_count == 0) && cards[cardno].m_read_wait) {
+    card_poll_block(cardno);
+  }
+
   if (cards[cardno].m_out_ptr < SPI_DELAY_RESPONSE) {
     cards[cardno].m_out_ptr++;
   } else if (cards[cardno].m_out_count > 0) {
@@ -345,8 +520,20 @@ void do_command(int cardno)
       break;
 
     case 9: // CMD9 - SEND_CSD
-      cards[cardno].m_data[0] = 0x00; // TODO
-      send_data(cardno, 1, SD_STATE_STBY);
+      if (cards[cardno].m_harddisk != NULL) {
+        cards[cardno].m_data[0] = 0x00; // initial R1 response
+        cards[cardno].m_data[1] = 0xff; // throwaway byte before data transfer
+        cards[cardno].m_data[2] = 0xfe; // data token
+        card_csd(cardno, &cards[cardno].m_data[3]);
+        uint16_t crc16 = crc16spi_fujitsu_byte(
+            0, &cards[cardno].m_data[3], 16);
+        cards[cardno].m_data[19] = (crc16 >> 8) & 0xff;
+        cards[cardno].m_data[20] = (crc16 & 0xff);
+        send_data(cardno, 3 + 16 + 2, SD_STATE_STBY);
+      } else {
+        cards[cardno].m_data[0] = 0xff; // show an error
+        send_data(cardno, 1, SD_STATE_STBY);
+      }
       break;
 
     case 10: // CMD10 - SEND_CID
@@ -392,8 +579,19 @@ void do_command(int cardno)
       send_data(cardno, 1, SD_STATE_STBY);
       break;
 
-    case 16: // CMD16 - SET_BLOCKLEN
-      cards[cardno].m_blksize = ((uint16_t)cards[cardno].m_cmd[3] << 8) | (uint16_t)cards[cardno].m_cmd[4];
+    case 16: { // CMD16 - SET_BLOCKLEN
+      uint16_t blksize = ((uint16_t)cards[cardno].m_cmd[3] << 8) | (uint16_t)cards[cardno].m_cmd[4];
+
+      cards[cardno].m_ahead_count = 0;
+
+      // m_data holds a block with its token and CRC
+      if ((blksize == 0) || (blksize > 512)) {
+        cards[cardno].m_data[0] = 0x40; // parameter error
+        send_data(cardno, 1, SD_STATE_TRAN);
+        break;
+      }
+      cards[cardno].m_blksize = blksize;
+
       if (cards[cardno].m_harddisk != NULL) {
         cards[cardno].m_data[0] = 0;
       } else {
@@ -407,6 +605,7 @@ void do_command(int cardno)
       }
       send_data(cardno, 1, SD_STATE_TRAN);
       break;
+    }
 
     case 17: // CMD17 - READ_SINGLE_BLOCK
       if (cards[cardno].m_harddisk != NULL) {
@@ -414,7 +613,6 @@ void do_command(int cardno)
         // data token occurs some time after the R1 response.  A2SD expects at least 1
         // byte of space between R1 and the data packet.
         cards[cardno].m_data[1] = 0xff;
-        cards[cardno].m_data[2] = 0xfe; // data token
         uint32_t blk = ((uint32_t)cards[cardno].m_cmd[1]
                            << 24)
             | ((uint32_t)cards[cardno].m_cmd[2]
@@ -425,22 +623,14 @@ void do_command(int cardno)
         if (cards[cardno].m_type == SD_TYPE_V2) {
           blk /= cards[cardno].m_blksize;
         }
-        card_read(cardno, blk,
-            &cards[cardno].m_data[3]);
-        {
-          uint16_t crc16 = crc16spi_fujitsu_byte(
-              0, &cards[cardno].m_data[3],
-              cards[cardno].m_blksize);
-          cards[cardno]
-              .m_data[cards[cardno].m_blksize + 3]
-              = (crc16 >> 8) & 0xff;
-          cards[cardno]
-              .m_data[cards[cardno].m_blksize + 4]
-              = (crc16 & 0xff);
+        if (card_start_block(cardno, blk, false)) {
+          send_data(cardno, 2 + card_load_block(cardno, blk, 2),
+              SD_STATE_DATA);
+        } else {
+          // the host polls for the token while the block is read
+          send_data(cardno, 2, SD_STATE_DATA);
+          cards[cardno].m_read_wait = true;
         }
-        send_data(cardno,
-            3 + cards[cardno].m_blksize + 2,
-            SD_STATE_DATA);
       } else {
         cards[cardno].m_data[0] = 0xff; // show an error
         send_data(cardno, 1, SD_STATE_DATA);
@@ -470,14 +660,53 @@ void do_command(int cardno)
       break;
 
     case 24: // CMD24 - WRITE_BLOCK
+    case 25: // CMD25 - WRITE_MULTIPLE_BLOCK
       cards[cardno].m_data[0] = 0;
       cards[cardno].m_blknext = ((uint32_t)cards[cardno].m_cmd[1] << 24) | ((uint32_t)cards[cardno].m_cmd[2] << 16) | ((uint32_t)cards[cardno].m_cmd[3] << 8) | (uint32_t)cards[cardno].m_cmd[4];
       if (cards[cardno].m_type == SD_TYPE_V2) {
         cards[cardno].m_blknext /= cards[cardno].m_blksize;
       }
+      cards[cardno].m_write_multi = (cards[cardno].m_cmd[0] & 0x3f) == 25;
       send_data(cardno, 1, SD_STATE_WRITE_WAITFE);
       break;
 
+    case 23:
+      if (cards[cardno].m_bACMD) // ACMD23 - SET_WR_BLK_ERASE_COUNT
+      {
+        // only a hint for the following CMD25
+        cards[cardno].m_data[0] = 0;
+        send_data(cardno, 1, SD_STATE_TRAN);
+      } else // CMD23 - SET_BLOCK_COUNT is not supported in SPI mode
+      {
+        cards[cardno].m_data[0] = 0x04; // illegal command
+        send_data(cardno, 1, SD_STATE_TRAN);
+      }
+      break;
+
+    case 32: // CMD32 - ERASE_WR_BLK_START_ADDR
+      cards[cardno].m_erase_start = card_arg_block(cardno);
+      cards[cardno].m_data[0] = 0;
+      send_data(cardno, 1, SD_STATE_TRAN);
+      break;
+
+    case 33: // CMD33 - ERASE_WR_BLK_END_ADDR
+      cards[cardno].m_erase_end = card_arg_block(cardno);
+      cards[cardno].m_data[0] = 0;
+      send_data(cardno, 1, SD_STATE_TRAN);
+      break;
+
+    case 38: // CMD38 - ERASE
+      if (cards[cardno].m_harddisk != NULL) {
+        // R1b, one busy byte before the card is ready
+        cards[cardno].m_data[0] = card_erase(cardno);
+        cards[cardno].m_data[1] = 0x00;
+        send_data(cardno, 2, SD_STATE_TRAN);
+      } else {
+        cards[cardno].m_data[0] = 0xff; // show an error
+        send_data(cardno, 1, SD_STATE_TRAN);
+      }
+      break;
+
     case 41:
       if (cards[cardno].m_bACMD) // ACMD41 - SD_SEND_OP_COND
       {
@@ -544,3 +773,81 @@ void change_state(int cardno, sd_state new_state)
   // REF Table 4-35:Card State Transition Table
   cards[cardno].m_state = new_state;
 }
+
+// the card images themselves are not part of a snapshot
+void card_snapshot_save(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_SDCARD);
+  for (int cardno = 0; cardno < 2; cardno++) {
+    card* sd = &cards[cardno];
+
+    // the image on disk should match the moment of the snapshot
+    card_deselect(cardno);
+
+    emulatorSnapshotPut32(snap, sd->m_type);
+    emulatorSnapshotPut32(snap, sd->m_state);
+    emulatorSnapshotPutBytes(snap, sd->m_data, sizeof(sd->m_data));
+    emulatorSnapshotPutBytes(snap, sd->m_cmd, sizeof(sd->m_cmd));
+    emulatorSnapshotPut32(snap, sd->m_ss);
+    emulatorSnapshotPut32(snap, sd->m_in_bit);
+    emulatorSnapshotPut32(snap, sd->m_clk_state);
+    emulatorSnapshotPut8(snap, sd->m_in_latch);
+    emulatorSnapshotPut8(snap, sd->m_out_latch);
+    emulatorSnapshotPut8(snap, sd->m_cur_bit);
+    emulatorSnapshotPut16(snap, sd->m_out_count);
+    emulatorSnapshotPut16(snap, sd->m_out_ptr);
+    emulatorSnapshotPut16(snap, sd->m_write_ptr);
+    emulatorSnapshotPut16(snap, sd->m_blksize);
+    emulatorSnapshotPut32(snap, sd->m_blknext);
+    emulatorSnapshotPut8(snap, sd->m_bACMD);
+    emulatorSnapshotPut8(snap, sd->m_write_multi);
+    emulatorSnapshotPut8(snap, sd->m_read_wait);
+    emulatorSnapshotPut32(snap, sd->m_read_blk);
+    emulatorSnapshotPut32(snap, sd->m_erase_start);
+    emulatorSnapshotPut32(snap, sd->m_erase_end);
+  }
+  emulatorSnapshotEnd(snap);
+}
+
+void card_snapshot_load(emulator_snapshot_t* snap)
+{
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_SDCARD)) {
+    return;
+  }
+
+  for (int cardno = 0; cardno < 2; cardno++) {
+    card* sd = &cards[cardno];
+
+    sd->m_ahead_count = 0;
+
+    sd->m_type = emulatorSnapshotGet32(snap);
+    sd->m_state = emulatorSnapshotGet32(snap);
+    emulatorSnapshotGetBytes(snap, sd->m_data, sizeof(sd->m_data));
+    emulatorSnapshotGetBytes(snap, sd->m_cmd, sizeof(sd->m_cmd));
+    sd->m_ss = emulatorSnapshotGet32(snap);
+    sd->m_in_bit = emulatorSnapshotGet32(snap);
+    sd->m_clk_state = emulatorSnapshotGet32(snap);
+    sd->m_in_latch = emulatorSnapshotGet8(snap);
+    sd->m_out_latch = emulatorSnapshotGet8(snap);
+    sd->m_cur_bit = emulatorSnapshotGet8(snap);
+    sd->m_out_count = emulatorSnapshotGet16(snap);
+    sd->m_out_ptr = emulatorSnapshotGet16(snap);
+    sd->m_write_ptr = emulatorSnapshotGet16(snap);
+    sd->m_blksize = emulatorSnapshotGet16(snap);
+    sd->m_blknext = emulatorSnapshotGet32(snap);
+    sd->m_bACMD = emulatorSnapshotGet8(snap);
+    sd->m_write_multi = emulatorSnapshotGet8(snap);
+    sd->m_read_wait = emulatorSnapshotGet8(snap);
+    sd->m_read_blk = emulatorSnapshotGet32(snap);
+    sd->m_erase_start = emulatorSnapshotGet32(snap);
+    sd->m_erase_end = emulatorSnapshotGet32(snap);
+    sd->m_read_polls = 0;
+
+    // keep the buffer indexes inside m_data
+    if ((sd->m_blksize == 0) || (sd->m_blksize > (sizeof(sd->m_data) - 3)) || (sd->m_write_ptr > sizeof(sd->m_data))
+        || ((sd->m_out_ptr + sd->m_out_count) > (sizeof(sd->m_data) + SPI_DELAY_RESPONSE))) {
+      emulatorSnapshotFail(snap, "bad SD card state");
+      return;
+    }
+  }
+}
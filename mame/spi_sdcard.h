@@ -8,6 +8,9 @@
 #include <SDL3/SDL.h>
 #include <stdint.h>
 
+#include "emulator_sdimage.h"
+#include "emulator_snapshot.h"
+
 typedef enum { SD_TYPE_V2 = 0,
   SD_TYPE_HC } sd_type;
 
@@ -30,7 +33,8 @@ typedef enum {
   SD_STATE_WRITE_DATA
 } sd_state;
 
-void card_initialise(SDL_IOStream* sd1, SDL_IOStream* sd2);
+void card_initialise(emulator_sdimage_t* sd1, emulator_sdimage_t* sd2);
+void card_deselect(int cardno);
 void send_data(int cardno, uint16_t count, sd_state new_state);
 void do_command(int cardno);
 void change_state(int cardno, sd_state new_state);
@@ -40,4 +44,7 @@ void card_byte_in(int cardno, uint8_t m_latch_in);
 uint8_t card_byte_out(int cardno);
 void shift_out(void);
 
+void card_snapshot_save(emulator_snapshot_t* snap);
+void card_snapshot_load(emulator_snapshot_t* snap);
+
 #endif /* MAME_MACHINE_SPI_SDCARD_H */
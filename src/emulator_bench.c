@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2026 Graeme Gregory
+ *
+ * SPDX: GPL-2.0-only
+ */
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "emulator_bench.h"
+#include "emulator_options.h"
+#include "emulator_sdimage.h"
+
+/*
+ * Headless benchmark, runs a fixed number of emulated frames flat out
+ * and reports where the host time went. Time is charged to whichever
+ * bucket is current, code switches bucket on entry and back on exit so
+ * nested sections such as audio register writes from inside the CPU
+ * are not counted twice.
+ */
+
+uint64_t emulatorInstructions = 0;
+
+static const char* const benchBucketNames[EMU_BENCH_MAX] = {
+  "other",
+  "cpu",
+  "render",
+  "audio",
+  "device",
+};
+
+static int benchFrames = 0;
+static int benchFrameCount = 0;
+static bool benchDone = false;
+static int benchBucket = EMU_BENCH_OTHER;
+static uint64_t benchMark;
+static uint64_t benchStart;
+static uint64_t benchStartInstructions;
+static uint64_t benchTime[EMU_BENCH_MAX];
+
+bool emulatorBenchInit(void)
+{
+  benchFrames = emulatorOptionInt("bench");
+
+  if (benchFrames <= 0) {
+    benchFrames = 0;
+    return false;
+  }
+
+  return true;
+}
+
+// start the clock once the machine is set up, boot loading is not timed
+void emulatorBenchStart(void)
+{
+  SDL_memset(benchTime, 0, sizeof(benchTime));
+  benchStart = benchMark = SDL_GetPerformanceCounter();
+  benchStartInstructions = emulatorInstructions;
+}
+
+bool emulatorBenchEnabled(void)
+{
+  return benchFrames > 0;
+}
+
+bool emulatorBenchDone(void)
+{
+  return benchDone;
+}
+
+int emulatorBenchSwitch(int bucket)
+{
+  int previous = benchBucket;
+
+  if (!benchFrames) {
+    return previous;
+  }
+
+  uint64_t now = SDL_GetPerformanceCounter();
+
+  benchTime[benchBucket] += now - benchMark;
+  benchMark = now;
+  benchBucket = bucket;
+
+  return previous;
+}
+
+static void emulatorBenchReport(void)
+{
+  double freq = SDL_GetPerformanceFrequency();
+  double seconds = (SDL_GetPerformanceCounter() - benchStart) / freq;
+  double emulated = benchFrameCount / 50.0;
+  uint64_t instructions = emulatorInstructions - benchStartInstructions;
+  emulator_sdimage_stats_t sd;
+
+  sdImageStats(&sd);
+
+  if (seconds <= 0.0) {
+    seconds = 1.0 / freq;
+  }
+
+  printf("{\n");
+  printf("  \"emulator\": \"%s\",\n", EMU_STR);
+  printf("  \"frames\": %d,\n", benchFrameCount);
+  printf("  \"instructions\": %" SDL_PRIu64 ",\n", instructions);
+  printf("  \"seconds\": %.6f,\n", seconds);
+  printf("  \"instructions_per_second\": %.0f,\n", instructions / seconds);
+  printf("  \"speed\": %.3f,\n", emulated / seconds);
+  printf("  \"time\": {\n");
+
+  for (int i = 0; i < EMU_BENCH_MAX; i++) {
+    printf("    \"%s\": %.6f%s\n", benchBucketNames[i],
+        benchTime[i] / freq, (i < (EMU_BENCH_MAX - 1)) ? "," : "");
+  }
+
+  printf("  },\n");
+  printf("  \"sd_cache\": {\n");
+  printf("    \"hits\": %" SDL_PRIu64 ",\n", sd.hits);
+  printf("    \"misses\": %" SDL_PRIu64 ",\n", sd.misses);
+  printf("    \"writebacks\": %" SDL_PRIu64 "\n", sd.writebacks);
+  printf("  }\n");
+  printf("}\n");
+  fflush(stdout);
+}
+
+// called once per emulated 50Hz frame
+void emulatorBenchFrame(void)
+{
+  if (!benchFrames || benchDone) {
+    return;
+  }
+
+  if (++benchFrameCount >= benchFrames) {
+    emulatorBenchSwitch(benchBucket);
+    emulatorBenchReport();
+    benchDone = true;
+  }
+}
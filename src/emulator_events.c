@@ -10,6 +10,8 @@
 
 #include "emulator_keyboard.h"
 #include "emulator_screen.h"
+#include "emulator_sdimage.h"
+#include "emulator_snapshot.h"
 #include "sdl-ps2.h"
 
 static bool shift = false;
@@ -20,11 +22,35 @@ bool emulatorProcessEvents(SDL_Event* event)
   case SDL_EVENT_QUIT:
     return false;
     break;
+  case SDL_EVENT_WINDOW_EXPOSED:
+  case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+    emulatorScreenRedraw();
+    break;
   case SDL_EVENT_KEY_DOWN:
     switch (event->key.key) {
     case SDLK_LSHIFT:
       shift = true;
       break;
+    case SDLK_F7:
+      if (shift) {
+        sdImageSyncAll();
+      }
+      break;
+    case SDLK_F8:
+      if (shift) {
+        emulatorSnapshotSave(emulatorSnapshotFile());
+      }
+      break;
+    case SDLK_F9:
+      if (shift) {
+        emulatorSnapshotLoad(emulatorSnapshotFile());
+      }
+      break;
+    case SDLK_F10:
+      if (shift) {
+        emulatorTogglePalette();
+      }
+      break;
     case SDLK_F11:
       if (shift) {
         emulatorToggleRefresh();
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2026 Graeme Gregory
+ *
+ * SPDX: GPL-2.0-only
+ */
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "emulator_hle.h"
+#include "emulator_options.h"
+#include "emulator_trace.h"
+#include "m68k.h"
+
+#define HLE_MAX_ENTRIES 16
+#define HLE_ENTRY_LEN 128
+
+bool emulatorHleActive = false;
+
+static emulator_hle_t hleEntries[HLE_MAX_ENTRIES];
+static int hleCount = 0;
+static unsigned int hleLow = UINT32_MAX;
+static unsigned int hleHigh = 0;
+
+// split off the next : separated field, NULL when there is none
+static char* emulatorHleField(char** rest)
+{
+  char* field = *rest;
+
+  if (!field) {
+    return NULL;
+  }
+
+  char* colon = SDL_strchr(field, ':');
+  if (colon) {
+    *colon = '\0';
+    *rest = colon + 1;
+  } else {
+    *rest = NULL;
+  }
+
+  return field;
+}
+
+static int emulatorHleRegister(const char* name)
+{
+  if ((SDL_strlen(name) != 2) || (name[1] < '0') || (name[1] > '7')) {
+    return -1;
+  }
+
+  switch (name[0]) {
+  case 'd':
+  case 'D':
+    return M68K_REG_D0 + (name[1] - '0');
+  case 'a':
+  case 'A':
+    return M68K_REG_A0 + (name[1] - '0');
+  default:
+    return -1;
+  }
+}
+
+static bool emulatorHleParse(const char* entry, const char* const* ops,
+    emulator_hle_t* hle)
+{
+  char buf[HLE_ENTRY_LEN];
+  char* rest = buf;
+  char* end;
+
+  SDL_strlcpy(buf, entry, sizeof(buf));
+
+  const char* addr = emulatorHleField(&rest);
+  const char* op = emulatorHleField(&rest);
+  const char* unit = emulatorHleField(&rest);
+  char* regs = emulatorHleField(&rest);
+
+  if (!regs || rest) {
+    return false;
+  }
+
+  hle->pc = strtoul(addr, &end, 0);
+  if ((*end != '\0') && !emulatorTraceLookup(addr, &hle->pc)) {
+    return false;
+  }
+
+  hle->op = -1;
+  for (int i = 0; ops[i]; i++) {
+    if (SDL_strcmp(op, ops[i]) == 0) {
+      hle->op = i;
+      break;
+    }
+  }
+  if (hle->op < 0) {
+    return false;
+  }
+
+  hle->unit = strtol(unit, &end, 0);
+  if (*end != '\0') {
+    return false;
+  }
+
+  hle->regCount = 0;
+  while (regs && *regs) {
+    char* comma = SDL_strchr(regs, ',');
+
+    if (comma) {
+      *comma = '\0';
+    }
+
+    int reg = emulatorHleRegister(regs);
+    if ((reg < 0) || (hle->regCount >= EMU_HLE_REGS)) {
+      return false;
+    }
+    hle->regs[hle->regCount++] = reg;
+
+    regs = comma ? comma + 1 : NULL;
+  }
+
+  return true;
+}
+
+void emulatorHleAdd(const char* option, const char* const* ops,
+    const emulator_hle_t* hle)
+{
+  if (hleCount >= HLE_MAX_ENTRIES) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "Too many high level entries, ignoring %s %s", option, ops[hle->op]);
+    return;
+  }
+
+  hleEntries[hleCount++] = *hle;
+  hleLow = SDL_min(hleLow, hle->pc);
+  hleHigh = SDL_max(hleHigh, hle->pc);
+  emulatorHleActive = true;
+
+  SDL_Log("%s %s at %8.8x", option, ops[hle->op], hle->pc);
+}
+
+void emulatorHleInit(const char* option, const char* const* ops,
+    emulator_hle_fn fn)
+{
+  for (int i = 0; i < emulatorOptionDevCount(option); i++) {
+    const char* entry = emulatorOptionDev(option, i);
+    emulator_hle_t hle;
+
+    if (!emulatorHleParse(entry, ops, &hle)) {
+      SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+          "%s %s is not addr:op:unit:reg,reg", option, entry);
+      continue;
+    }
+
+    hle.fn = fn;
+    emulatorHleAdd(option, ops, &hle);
+  }
+}
+
+// returns true when the instruction at pc was replaced
+bool emulatorHleHook(unsigned int pc)
+{
+  if ((pc < hleLow) || (pc > hleHigh)) {
+    return false;
+  }
+
+  for (int i = 0; i < hleCount; i++) {
+    if (hleEntries[i].pc == pc) {
+      return hleEntries[i].fn(&hleEntries[i]);
+    }
+  }
+
+  return false;
+}
+
+// arguments missing from the entry read as zero and are not written
+uint32_t emulatorHleReg(const emulator_hle_t* hle, int arg)
+{
+  if (arg >= hle->regCount) {
+    return 0;
+  }
+
+  return m68k_get_reg(NULL, hle->regs[arg]);
+}
+
+void emulatorHleSetReg(const emulator_hle_t* hle, int arg, uint32_t val)
+{
+  if (arg < hle->regCount) {
+    m68k_set_reg(hle->regs[arg], val);
+  }
+}
+
+// carry on from the subroutine's return address as RTS would, skip is
+// for routines that return past it to signal their result
+void emulatorHleReturn(unsigned int skip)
+{
+  unsigned int sp = m68k_get_reg(NULL, M68K_REG_A7);
+
+  m68k_set_reg(M68K_REG_PC, m68k_read_memory_32(sp) + skip);
+  m68k_set_reg(M68K_REG_A7, sp + 4);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2026 Graeme Gregory
+ *
+ * SPDX: GPL-2.0-only
+ */
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "emulator_idle.h"
+#include "emulator_memory.h"
+#include "emulator_options.h"
+#include "emulator_trace.h"
+#include "m68k.h"
+
+/*
+ * Guest idle detection for cpu_hog = 0. The guest counts as idle when
+ * it spins in a short backward loop that stores nothing and leaves the
+ * registers as it found them, it can only be waiting on an interrupt or
+ * device. Known idle loops can also be given by address or trace-map
+ * symbol with idle-pc. When idle the current timeslice is ended and the
+ * main loop skips ahead or sleeps until the next event.
+ */
+
+// longest loop body in bytes considered a tight loop
+#define IDLE_LOOP_BYTES 32
+// unchanged iterations before the loop counts as idle
+#define IDLE_LOOP_COUNT 4
+// iterations to ignore a loop that turned out to be doing work
+#define IDLE_LOOP_BACKOFF 64
+#define IDLE_MAX_PCS 16
+// D0-D7, A0-A7 and SR
+#define IDLE_REGS 17
+
+bool emulatorIdleDetect = false;
+
+static bool idle = false;
+static unsigned int lastPc = 0;
+
+static unsigned int loopPc = 0;
+static unsigned int loopCount = 0;
+static unsigned int loopBackoff = 0;
+static uint32_t loopWrites = 0;
+static unsigned int loopRegs[IDLE_REGS];
+
+static unsigned int idlePcs[IDLE_MAX_PCS];
+static int idlePcCount = 0;
+static unsigned int idlePcLow = UINT32_MAX;
+static unsigned int idlePcHigh = 0;
+static unsigned int idleHitPc = 0;
+static uint32_t idleHitWrites = 0;
+
+static void emulatorIdleAddPc(const char* entry)
+{
+  char* end;
+  unsigned int pc = strtoul(entry, &end, 0);
+
+  if ((*end != '\0') && !emulatorTraceLookup(entry, &pc)) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "idle-pc %s is not an address or trace-map symbol", entry);
+    return;
+  }
+
+  if (idlePcCount >= IDLE_MAX_PCS) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "Too many idle-pc entries, ignoring %s", entry);
+    return;
+  }
+
+  idlePcs[idlePcCount++] = pc;
+  idlePcLow = SDL_min(idlePcLow, pc);
+  idlePcHigh = SDL_max(idlePcHigh, pc);
+
+  SDL_Log("Idle PC %8.8x", pc);
+}
+
+void emulatorIdleInit(void)
+{
+  if (emulatorOptionInt("cpu_hog")) {
+    return;
+  }
+
+  emulatorIdleDetect = true;
+
+  for (int i = 0; i < emulatorOptionDevCount("idle-pc"); i++) {
+    emulatorIdleAddPc(emulatorOptionDev("idle-pc", i));
+  }
+}
+
+static void emulatorIdleEnter(void)
+{
+  idle = true;
+  loopPc = 0;
+  loopCount = 0;
+
+  // finish the slice after this instruction, keeps the cycle count right
+  m68k_modify_timeslice(-m68k_cycles_remaining());
+}
+
+static void emulatorIdleSnapshot(unsigned int pc)
+{
+  loopPc = pc;
+  loopCount = 0;
+  loopWrites = emulatorWriteCount;
+
+  for (int i = 0; i < 16; i++) {
+    loopRegs[i] = m68k_get_reg(NULL, M68K_REG_D0 + i);
+  }
+  loopRegs[16] = m68k_get_reg(NULL, M68K_REG_SR);
+}
+
+static bool emulatorIdleRegsSame(void)
+{
+  for (int i = 0; i < 16; i++) {
+    if (loopRegs[i] != m68k_get_reg(NULL, M68K_REG_D0 + i)) {
+      return false;
+    }
+  }
+
+  return loopRegs[16] == m68k_get_reg(NULL, M68K_REG_SR);
+}
+
+static void emulatorIdleLoop(unsigned int pc)
+{
+  if (pc != loopPc) {
+    loopBackoff = 0;
+    emulatorIdleSnapshot(pc);
+    return;
+  }
+
+  if (loopBackoff) {
+    if (--loopBackoff == 0) {
+      emulatorIdleSnapshot(pc);
+    }
+    return;
+  }
+
+  if ((emulatorWriteCount != loopWrites) || !emulatorIdleRegsSame()) {
+    loopBackoff = IDLE_LOOP_BACKOFF;
+    return;
+  }
+
+  if (++loopCount >= IDLE_LOOP_COUNT) {
+    emulatorIdleEnter();
+  }
+}
+
+static void emulatorIdlePc(unsigned int pc)
+{
+  for (int i = 0; i < idlePcCount; i++) {
+    if (idlePcs[i] != pc) {
+      continue;
+    }
+
+    // twice round without a store in between
+    if ((pc == idleHitPc) && (emulatorWriteCount == idleHitWrites)) {
+      idleHitPc = 0;
+      emulatorIdleEnter();
+    } else {
+      idleHitPc = pc;
+      idleHitWrites = emulatorWriteCount;
+    }
+
+    return;
+  }
+}
+
+// called for every instruction when cpu_hog is off
+void emulatorIdleHook(unsigned int pc)
+{
+  if ((pc < lastPc) && ((lastPc - pc) <= IDLE_LOOP_BYTES)) {
+    emulatorIdleLoop(pc);
+  }
+
+  if ((pc >= idlePcLow) && (pc <= idlePcHigh)) {
+    emulatorIdlePc(pc);
+  }
+
+  lastPc = pc;
+}
+
+// returns true once for each time the guest was found idle
+bool emulatorIdleTake(void)
+{
+  bool wasIdle = idle;
+
+  idle = false;
+
+  return wasIdle;
+}
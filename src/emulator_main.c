@@ -10,11 +10,15 @@
 #include <SDL3/SDL_main.h>
 #include <stdio.h>
 
+#include "emulator_bench.h"
 #include "emulator_events.h"
+#include "emulator_idle.h"
 #include "emulator_mainloop.h"
 #include "emulator_memory.h"
 #include "emulator_options.h"
 #include "emulator_screen.h"
+#include "emulator_sdimage.h"
+#include "emulator_snapshot.h"
 #include "emulator_trace.h"
 
 #if __EMSCRIPTEN__
@@ -25,10 +29,18 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
 {
   emulatorOptionParse(argc, argv);
 
+  // benchmarks run without a display or audio device
+  bool bench = emulatorBenchInit();
+  SDL_InitFlags flags = SDL_INIT_EVENTS;
+
+  if (!bench) {
+    flags |= SDL_INIT_VIDEO | SDL_INIT_AUDIO;
+  }
+
   SDL_SetAppMetadata(EMU_STR " emulator for the Sinclair QL", "0.1",
       "https://github.com/xXorAa/sQ68Lay/");
 
-  if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_AUDIO)) {
+  if (!SDL_Init(flags)) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "SDL_Init Error: %s",
         SDL_GetError());
     return SDL_APP_FAILURE;
@@ -36,6 +48,9 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
 
   // set the framerate limit
   emulatorSetRefresh(false);
+  if (bench) {
+    SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "0");
+  }
 
   // BUG: workaround https://github.com/libsdl-org/SDL/issues/12805
 #if __EMSCRIPTEN__
@@ -48,6 +63,8 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
   emulatorInitScreen(1);
 
   emulatorTraceInit();
+  emulatorIdleInit();
+  emulatorBootSnapshotInit();
 
   *appstate = emulatorInitEmulation();
   if (!*appstate) {
@@ -56,6 +73,14 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
     return SDL_APP_FAILURE;
   }
 
+  if (emulatorBootSnapshotPending()) {
+    emulatorBootSnapshotRestore();
+  }
+
+  if (bench) {
+    emulatorBenchStart();
+  }
+
   return SDL_APP_CONTINUE;
 }
 
@@ -64,6 +89,11 @@ SDL_AppResult SDL_AppIterate(void* appstate)
   (void)appstate;
 
   emulatorInteration(appstate);
+  emulatorBootSnapshotPoll();
+
+  if (emulatorBenchDone()) {
+    return SDL_APP_SUCCESS;
+  }
 
   return SDL_APP_CONTINUE;
 }
@@ -82,5 +112,8 @@ void SDL_AppQuit(void* appstate, SDL_AppResult result)
   (void)appstate;
   (void)result;
 
+  emulatorExitEmulation();
+  sdImageCloseAll();
+  emulatorQuitScreen();
   SDL_Quit();
 }
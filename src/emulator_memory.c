@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2026 Graeme Gregory
+ *
+ * SPDX: GPL-2.0-only
+ */
+
+#include <SDL3/SDL.h>
+#include <stdint.h>
+
+#include "emulator_memory.h"
+#include "m68k.h"
+
+/*
+ * Block transfers for device models. Directly mapped pages are copied
+ * with memcpy and written screen lines marked dirty, the rest go byte
+ * by byte through the machine's address decode so IO, ROM protection
+ * and unmapped space behave as for the CPU. That decode charges its own
+ * waits, the waits of the mapped pages are returned for the device to
+ * add to its transfer time.
+ */
+
+static void emulatorMemoryMarkDirty(emulator_page_t* page, uint32_t offset,
+    size_t size)
+{
+  uint32_t last = offset + size - 1;
+
+  for (uint32_t chunk = offset >> EMU_DIRTY_SHIFT;
+      chunk <= (last >> EMU_DIRTY_SHIFT); chunk++) {
+    EMU_PAGE_MARK_DIRTY(page, chunk << EMU_DIRTY_SHIFT);
+  }
+}
+
+unsigned int emulatorMemoryRead(uint32_t address, void* data, size_t size)
+{
+  uint8_t* dst = data;
+  unsigned int wait = 0;
+
+  while (size) {
+    const emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+    uint32_t offset = address & EMU_PAGE_MASK;
+    size_t len = SDL_min(size, EMU_PAGE_SIZE - offset);
+
+    if (page->read) {
+      SDL_memcpy(dst, &page->read[offset], len);
+      wait += page->wait * len;
+    } else {
+      for (size_t i = 0; i < len; i++) {
+        dst[i] = m68k_read_memory_8(address + i);
+      }
+    }
+
+    address += len;
+    dst += len;
+    size -= len;
+  }
+
+  return wait;
+}
+
+unsigned int emulatorMemoryWrite(uint32_t address, const void* data,
+    size_t size)
+{
+  const uint8_t* src = data;
+  unsigned int wait = 0;
+
+  emulatorWriteCount++;
+
+  while (size) {
+    emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+    uint32_t offset = address & EMU_PAGE_MASK;
+    size_t len = SDL_min(size, EMU_PAGE_SIZE - offset);
+
+    if (page->write) {
+      if (page->dirty) {
+        emulatorMemoryMarkDirty(page, offset, len);
+      }
+      SDL_memcpy(&page->write[offset], src, len);
+      wait += page->wait * len;
+    } else {
+      for (size_t i = 0; i < len; i++) {
+        m68k_write_memory_8(address + i, src[i]);
+      }
+    }
+
+    address += len;
+    src += len;
+    size -= len;
+  }
+
+  return wait;
+}
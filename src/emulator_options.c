@@ -148,9 +148,22 @@ struct emuOpts emuOptions[] = {
       NULL, NULL },
   { "ipcvol", "", "volume of IPC sound in range 0-10", EMU_OPT_INT, 3,
       NULL, NULL },
+  { "mdv-flush", "",
+      "seconds without MDV writes before saving them, 0 when the motor stops",
+      EMU_OPT_INT, 0, NULL, NULL },
+  { "mdv-hle", "", "move whole microdrive sectors through the QDOS vectors",
+      EMU_OPT_INT, 0, NULL, NULL },
+  { "mdv-hle-pc", "",
+      "addr:sector|read|verify|write:drive:reg,reg MDV routine to replace",
+      EMU_OPT_DEV, 0, NULL, NULL },
   { "mdvvol", "", "volume of MDV sound effect in range 0-10", EMU_OPT_INT,
       3, NULL, NULL },
   { "qlsd", "", "turn on qlsd emulation", EMU_OPT_INT, 0, NULL, NULL },
+  { "qlsd-hle", "",
+      "addr:read|write|readblock|writeblock:card:reg,reg QL-SD routine to replace",
+      EMU_OPT_DEV, 0, NULL, NULL },
+  { "qlsd-hle-cycles", "", "cycles charged per byte moved by qlsd-hle",
+      EMU_OPT_INT, 48, NULL, NULL },
   { "qsound", "", "address in hex of qsound registers", EMU_OPT_CHAR, 0,
       NULL, NULL },
   { "ramsize", "m", "amount of ram in K (max 8192)", EMU_OPT_INT, 128,
@@ -163,13 +176,54 @@ struct emuOpts emuOptions[] = {
 #ifdef Q68_EMU
   { "smsqe", "", "smsqe image to load (at 0x32000)", EMU_OPT_CHAR, 0,
       NULL, NULL },
+  { "spi-hle", "",
+      "addr:byte|read|write:card:reg,reg bit-banged SPI routine to replace",
+      EMU_OPT_DEV, 0, NULL, NULL },
   { "sssvol", "", "volume of SSS sound in range 0-10", EMU_OPT_INT, 3,
       NULL, NULL },
   { "sysrom", "r", "system rom to load (at 0x0)", EMU_OPT_CHAR, 0, NULL,
       NULL },
 #endif
+  { "bench", "", "run N frames headless and print statistics as JSON",
+      EMU_OPT_INT, 0, NULL, NULL },
+  { "boot-snapshot", "", "snapshot taken after boot and restored on start",
+      EMU_OPT_CHAR, 0, NULL, NULL },
+  { "boot-snapshot-frames", "", "frames to run before the boot snapshot",
+      EMU_OPT_INT, 250, NULL, NULL },
+  { "boot-snapshot-pc", "",
+      "address or trace-map symbol to take the boot snapshot at",
+      EMU_OPT_CHAR, 0, NULL, NULL },
+  { "cpu_hog", "", "1 = use all cpu, 0 = sleep when idle", EMU_OPT_INT, 1,
+      NULL, NULL },
+  { "fast_startup", "", "1 = boot from a boot snapshot when possible",
+      EMU_OPT_INT, 0, NULL, NULL },
+  { "idle-pc", "", "address or trace-map symbol of a guest idle loop",
+      EMU_OPT_DEV, 0, NULL, NULL },
+  { "palette", "",
+      "0 = Full colour, 1 = Unsaturated colours, 2 = Greyscale",
+      EMU_OPT_INT, 0, NULL, NULL },
+  { "sd-async", "", "1 = SD card cache reads and writes on an I/O thread",
+      EMU_OPT_INT, 0, NULL, NULL },
+  { "sd-cache", "", "SD card cache size in KB, at least 32", EMU_OPT_INT,
+      1024, NULL, NULL },
+  { "sd-mmap", "", "1 = memory map SD card images", EMU_OPT_INT, 0, NULL,
+      NULL },
+  { "sd-msync", "",
+      "mapped SD image sync, 0 = on exit, 1 = on card release, 2 = each second",
+      EMU_OPT_INT, 1, NULL, NULL },
+  { "sd-overlay-exit", "",
+      "SD overlays on exit, 0 = keep, 1 = commit to the base, 2 = discard",
+      EMU_OPT_INT, 0, NULL, NULL },
   { "sd1", "", "SDHC Image for SD1 slot", EMU_OPT_CHAR, 0, NULL, NULL },
+  { "sd1-overlay", "", "delta file making the SD1 image copy-on-write",
+      EMU_OPT_CHAR, 0, NULL, NULL },
   { "sd2", "", "SDHC Image for SD1 slot", EMU_OPT_CHAR, 0, NULL, NULL },
+  { "sd2-overlay", "", "delta file making the SD2 image copy-on-write",
+      EMU_OPT_CHAR, 0, NULL, NULL },
+  { "snapshot", "", "snapshot file for shift+F8 save and shift+F9 restore",
+      EMU_OPT_CHAR, 0, NULL, NULL },
+  { "snapshot-compress", "", "1 = compress snapshot memory, 0 = store it",
+      EMU_OPT_INT, 1, NULL, NULL },
   { "trace", "", "enable tracing", EMU_OPT_INT, 0, NULL, NULL },
   { "trace-high", "", "highest address to trace", EMU_OPT_INT, 0xFFFFFF,
       NULL, NULL },
@@ -422,3 +476,34 @@ char* emulatorOptionArgv(int idx)
 {
   return ap_get_arg_at_index(parser, idx);
 }
+
+// every option with its value, ints as text, then the positional args
+void emulatorOptionForEach(void (*fn)(const char* name, const char* value,
+                               void* user),
+    void* user)
+{
+  char intVal[16];
+
+  for (int i = 0; emuOptions[i].option != NULL; i++) {
+    const char* name = emuOptions[i].option;
+
+    switch (emuOptions[i].type) {
+    case EMU_OPT_INT:
+      snprintf(intVal, sizeof(intVal), "%d", emulatorOptionInt(name));
+      fn(name, intVal, user);
+      break;
+    case EMU_OPT_CHAR:
+      fn(name, emulatorOptionString(name), user);
+      break;
+    case EMU_OPT_DEV:
+      for (int j = 0; j < emulatorOptionDevCount(name); j++) {
+        fn(name, emulatorOptionDev(name, j), user);
+      }
+      break;
+    }
+  }
+
+  for (int i = 0; i < emulatorOptionArgc(); i++) {
+    fn("", emulatorOptionArgv(i), user);
+  }
+}
@@ -9,6 +9,13 @@
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "emulator_bench.h"
 #include "emulator_hardware.h"
 #include "emulator_memory.h"
 #include "emulator_options.h"
@@ -50,37 +57,270 @@ bool emulatorSecondScreen = false;
 
 static bool emulatorScreenFast = false;
 static bool emulatorScreenFull = false;
+static bool emulatorScreenHeadless = false;
+static uint32_t* emulatorHeadlessPixels = NULL;
 static const char* emulatorName = EMU_STR;
 static char fastfps[] = "0000";
 
+enum {
+  EMU_PALETTE_FULL,
+  EMU_PALETTE_UNSATURATED,
+  EMU_PALETTE_GREY,
+  EMU_PALETTE_MAX,
+};
+
+/*
+ * Colour lookup tables for one palette, the 16 bit table is indexed by
+ * the big endian screen word as it sits in host memory.
+ */
+struct emulatorPalette {
+  Uint32 ql[16];
+  Uint32 rgb16[65536];
+  Uint32 aurora[256];
+};
+
+static struct emulatorPalette* emulatorPalettes[EMU_PALETTE_MAX];
+static struct emulatorPalette* emulatorPalette = NULL;
+static int emulatorPaletteIdx = EMU_PALETTE_FULL;
+
+/*
+ * Each mode has a pair of streaming textures, the converters write into
+ * one while the other is on display. A texture misses the lines drawn
+ * into its partner, those are tracked as a range to redraw next time.
+ */
 struct qlMode {
   uint32_t base;
   uint32_t size;
   int xRes;
   int yRes;
-  SDL_Surface* surface;
-  SDL_Texture* texture;
+  int lineBytes;
+  SDL_Texture* texture[2];
+  int next;
+  int missFirst[2];
+  int missLast[2];
 };
 
 struct qlMode qlModes[8] = {
-  { 0x00020000, KB(32), 512, 256, NULL,
-      NULL }, // ql mode 8              0
-  { 0x00020000, KB(32), 512, 256, NULL,
-      NULL }, // ql mode 4              1
-  { 0xFE800000, KB(256), 512, 256, NULL,
-      NULL }, // small 16 bit screen    2
-  { 0xFE800000, MB(1), 1024, 512, NULL,
-      NULL }, // large 16 bit screen    3
-  { 0xFE800000, KB(192), 1024, 768, NULL,
-      NULL }, // large QL Mode 4 screen 4
-  { 0xFE800000, KB(512), 1024, 768, NULL,
-      NULL }, // auora 8 bit            5
-  { 0xFE800000, KB(384), 512, 384, NULL,
-      NULL }, // medium 16 bit screen   6
-  { 0xFE800000, MB(1) + KB(512), 1024, 768, NULL,
-      NULL } // huge 16 bit            7
+  { 0x00020000, KB(32), 512, 256, 128, { NULL, NULL }, 0,
+      { 0, 0 }, { 0, 0 } }, // ql mode 8              0
+  { 0x00020000, KB(32), 512, 256, 128, { NULL, NULL }, 0,
+      { 0, 0 }, { 0, 0 } }, // ql mode 4              1
+  { 0xFE800000, KB(256), 512, 256, 1024, { NULL, NULL }, 0,
+      { 0, 0 }, { 0, 0 } }, // small 16 bit screen    2
+  { 0xFE800000, MB(1), 1024, 512, 2048, { NULL, NULL }, 0,
+      { 0, 0 }, { 0, 0 } }, // large 16 bit screen    3
+  { 0xFE800000, KB(192), 1024, 768, 256, { NULL, NULL }, 0,
+      { 0, 0 }, { 0, 0 } }, // large QL Mode 4 screen 4
+  { 0xFE800000, KB(512), 1024, 768, 1024, { NULL, NULL }, 0,
+      { 0, 0 }, { 0, 0 } }, // auora 8 bit            5
+  { 0xFE800000, KB(384), 512, 384, 1024, { NULL, NULL }, 0,
+      { 0, 0 }, { 0, 0 } }, // medium 16 bit screen   6
+  { 0xFE800000, MB(1) + KB(512), 1024, 768, 2048, { NULL, NULL }, 0,
+      { 0, 0 }, { 0, 0 } } // huge 16 bit            7
+};
+
+uint32_t emulatorScreenDirty[EMU_DIRTY_CHUNKS / 32];
+
+/*
+ * A frame of work for the render thread. The changed lines of screen
+ * memory are copied into the job at the frame interrupt so the CPU can
+ * carry on emulating while the lines are converted straight into the
+ * locked texture. There are two jobs, one being filled by the CPU thread
+ * while the other is being converted.
+ */
+struct emulatorScreenJob {
+  struct qlMode* mode;
+  void (*convert)(const uint8_t*, uint32_t*, int);
+  uint8_t* snapshot;
+  size_t snapshotSize;
+  SDL_Texture* texture;
+  SDL_Rect rect;
+  uint8_t* pixels;
+  int pitch;
 };
 
+static struct emulatorScreenJob emulatorScreenJobs[2];
+static struct emulatorScreenJob* emulatorJobBusy = NULL;
+static SDL_Texture* emulatorShownTexture = NULL;
+
+static SDL_Thread* emulatorRenderThread = NULL;
+static SDL_Semaphore* emulatorRenderStart = NULL;
+static SDL_Semaphore* emulatorRenderDone = NULL;
+static SDL_AtomicInt emulatorRenderQuit;
+
+static bool emulatorScreenForce = true;
+static bool emulatorScreenPresent = true;
+static bool emulatorLastSecondScreen = false;
+
+static bool emulatorCreateModeTextures(struct qlMode* mode);
+static void emulatorInitRenderThread(void);
+static void emulatorScreenFlush(void);
+
+/*
+ * QL mode 4 and mode 8 lookup tables, indexed by a nibble from each of
+ * the two bytes of a screen word so each entry is four 32bit pixels,
+ * one 128bit vector. A table indexed by the whole word would be 2MB and
+ * thrash the caches of the smaller machines we run on.
+ */
+static _Alignas(16) uint32_t qlMode4Lut[256][4];
+static _Alignas(16) uint32_t qlMode8Lut[256][4];
+
+#if defined(__SSE2__)
+#define QL_LUT_COPY(dst, src) \
+  _mm_storeu_si128((__m128i*)(dst), _mm_load_si128((const __m128i*)(src)))
+#elif defined(__ARM_NEON)
+#define QL_LUT_COPY(dst, src) vst1q_u32((dst), vld1q_u32(src))
+#else
+#define QL_LUT_COPY(dst, src) \
+  do {                        \
+    (dst)[0] = (src)[0];      \
+    (dst)[1] = (src)[1];      \
+    (dst)[2] = (src)[2];      \
+    (dst)[3] = (src)[3];      \
+  } while (0)
+#endif
+
+static void emulatorBuildQLLuts(void)
+{
+  for (int idx = 0; idx < 256; idx++) {
+    uint8_t n1 = idx >> 4;
+    uint8_t n2 = idx & 0x0F;
+
+    // mode 4, one bit of each byte per pixel
+    for (int i = 3; i > -1; i--) {
+      uint8_t p1 = (n1 >> i) & 0x01;
+      uint8_t p2 = (n2 >> i) & 0x01;
+
+      int color = (p1 << 2) + (p2 << 1) + (p1 & p2);
+
+      qlMode4Lut[idx][3 - i] = sdlColors[color];
+    }
+
+    // mode 8, two bits of each byte per pixel and pixels doubled
+    for (int i = 2; i > -2; i -= 2) {
+      uint8_t p1 = (n1 >> i) & 0x03;
+      uint8_t p2 = (n2 >> i) & 0x03;
+
+      int color = ((p1 & 2) << 1) + (p2 & 3);
+
+      qlMode8Lut[idx][(2 - i)] = sdlColors[color];
+      qlMode8Lut[idx][(2 - i) + 1] = sdlColors[color];
+    }
+  }
+}
+
+static Uint32 emulatorMapRGB(int palette, Uint8 red, Uint8 green, Uint8 blue)
+{
+  // ITU-R BT.601 luma
+  int luma = (red * 299 + green * 587 + blue * 114) / 1000;
+
+  switch (palette) {
+  case EMU_PALETTE_UNSATURATED:
+    red = (red * 7 + luma * 3) / 10;
+    green = (green * 7 + luma * 3) / 10;
+    blue = (blue * 7 + luma * 3) / 10;
+    break;
+  case EMU_PALETTE_GREY:
+    red = green = blue = luma;
+    break;
+  default:
+    break;
+  }
+
+  return SDL_MapRGB(SDL_GetPixelFormatDetails(SDL_PIXELFORMAT_RGBA32),
+      NULL, red, green, blue);
+}
+
+static struct emulatorPalette* emulatorBuildPalette(int palette)
+{
+  struct emulatorPalette* colours = SDL_malloc(sizeof(*colours));
+
+  if (colours == NULL) {
+    fprintf(stderr, "Failed to allocate palette\n");
+    return NULL;
+  }
+
+  for (int i = 0; i < 16; i++) {
+    colours->ql[i] = emulatorMapRGB(palette, qlColors[i].r,
+        qlColors[i].g, qlColors[i].b);
+  }
+
+  for (int i = 0; i < 65536; i++) {
+    uint16_t pixel16 = SDL_Swap16BE((uint16_t)i);
+
+    // red
+    uint8_t red = (pixel16 & 0x07C0) >> 3;
+
+    // green
+    uint8_t green = (pixel16 & 0xF800) >> 8;
+
+    // blue
+    uint8_t blue = (pixel16 & 0x003E) << 2;
+
+    colours->rgb16[i] = emulatorMapRGB(palette, red, green, blue);
+  }
+
+  for (int i = 0; i < 256; i++) {
+    uint8_t pixel8 = i;
+
+    // red
+    uint8_t red = (pixel8 & (1 << 6)) >> 4;
+    red |= pixel8 & (1 << 3) >> 2;
+    red |= pixel8 & 1;
+    red *= 35;
+
+    // green
+    uint8_t green = (pixel8 & (1 << 7)) >> 5;
+    green |= (pixel8 & (1 << 4)) >> 3;
+    green |= (pixel8 & (1 << 1)) >> 1;
+    green *= 35;
+
+    // blue
+    uint8_t blue = (pixel8 & (1 << 5)) >> 3;
+    blue |= (pixel8 & (1 << 2)) >> 1;
+    blue |= pixel8 & 1;
+    blue *= 35;
+
+    colours->aurora[i] = emulatorMapRGB(palette, red, green, blue);
+  }
+
+  return colours;
+}
+
+// tables are built the first time a palette is selected and then kept
+bool emulatorScreenSetPalette(int palette)
+{
+  if ((palette < 0) || (palette >= EMU_PALETTE_MAX)) {
+    fprintf(stderr, "Invalid palette %d\n", palette);
+    return false;
+  }
+
+  if (emulatorPalettes[palette] == NULL) {
+    emulatorPalettes[palette] = emulatorBuildPalette(palette);
+
+    if (emulatorPalettes[palette] == NULL) {
+      return false;
+    }
+  }
+
+  // the render thread must not see the tables change under it
+  emulatorScreenFlush();
+
+  emulatorPaletteIdx = palette;
+  emulatorPalette = emulatorPalettes[palette];
+
+  SDL_memcpy(sdlColors, emulatorPalette->ql, sizeof(sdlColors));
+  emulatorBuildQLLuts();
+  emulatorScreenRedraw();
+
+  return true;
+}
+
+void emulatorTogglePalette(void)
+{
+  emulatorScreenSetPalette((emulatorPaletteIdx + 1) % EMU_PALETTE_MAX);
+}
+
 int emulatorInitScreen(int emulatorMode)
 {
   // Fixed screen res for emulator output
@@ -93,6 +333,26 @@ int emulatorInitScreen(int emulatorMode)
   emulatorDestRect.w = xRes;
   emulatorDestRect.h = yRes;
 
+  // the null backend converts frames into memory and displays nothing
+  if (emulatorBenchEnabled()) {
+    emulatorScreenHeadless = true;
+    emulatorHeadlessPixels = SDL_malloc((size_t)xRes * yRes * sizeof(uint32_t));
+
+    if (emulatorHeadlessPixels == NULL) {
+      fprintf(stderr, "Failed to allocate headless screen\n");
+      return 1;
+    }
+
+    if (!emulatorScreenSetPalette(emulatorOptionInt("palette"))
+        && !emulatorScreenSetPalette(EMU_PALETTE_FULL)) {
+      return 1;
+    }
+
+    emulatorInitRenderThread();
+
+    return 0;
+  }
+
   emulatorWindow = SDL_CreateWindow(emulatorName, xRes, yRes,
       SDL_WINDOW_RESIZABLE);
 
@@ -115,35 +375,18 @@ int emulatorInitScreen(int emulatorMode)
   SDL_RenderClear(emulatorRenderer);
   SDL_RenderPresent(emulatorRenderer);
 
-  for (int i = 0; i < 8; i++) {
-    qlModes[i].surface = SDL_CreateSurface(qlModes[i].xRes,
-        qlModes[i].yRes,
-        SDL_PIXELFORMAT_RGBA32);
-
-    if (qlModes[i].surface == NULL) {
-      fprintf(stderr, "Failed to Create Screen %s\n",
-          SDL_GetError());
-      return 1;
-    }
-
-    qlModes[i].texture = SDL_CreateTexture(
-        emulatorRenderer, SDL_PIXELFORMAT_RGBA32,
-        SDL_TEXTUREACCESS_STREAMING, qlModes[i].xRes,
-        qlModes[i].yRes);
-
-    if (qlModes[i].texture == NULL) {
-      fprintf(stderr, "Failed to Create Texture %s\n",
-          SDL_GetError());
-      return 1;
-    }
+  // textures for other modes are created when the guest selects them
+  if (!emulatorCreateModeTextures(&qlModes[emulatorMode])) {
+    return 1;
   }
 
-  for (int i = 0; i < 16; i++) {
-    sdlColors[i] = SDL_MapRGB(
-        SDL_GetPixelFormatDetails(qlModes[0].surface->format),
-        NULL, qlColors[i].r, qlColors[i].g, qlColors[i].b);
+  if (!emulatorScreenSetPalette(emulatorOptionInt("palette"))
+      && !emulatorScreenSetPalette(EMU_PALETTE_FULL)) {
+    return 1;
   }
 
+  emulatorInitRenderThread();
+
 #ifdef QLAY_EMU
   SDL_snprintf(fastfps, sizeof(fastfps), "%4d", emulatorOptionInt("fastfps"));
 #else
@@ -153,210 +396,460 @@ int emulatorInitScreen(int emulatorMode)
   return 0;
 }
 
+static bool emulatorCreateModeTextures(struct qlMode* mode)
+{
+  if (emulatorScreenHeadless) {
+    return true;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (mode->texture[i]) {
+      continue;
+    }
+
+    mode->texture[i] = SDL_CreateTexture(
+        emulatorRenderer, SDL_PIXELFORMAT_RGBA32,
+        SDL_TEXTUREACCESS_STREAMING, mode->xRes,
+        mode->yRes);
+
+    if (mode->texture[i] == NULL) {
+      fprintf(stderr, "Failed to Create Texture %s\n",
+          SDL_GetError());
+      return false;
+    }
+
+    // lines past the end of the screen memory are never converted
+    void* pixels;
+    int pitch;
+
+    if (SDL_LockTexture(mode->texture[i], NULL, &pixels, &pitch)) {
+      SDL_memset(pixels, 0, (size_t)pitch * mode->yRes);
+      SDL_UnlockTexture(mode->texture[i]);
+    }
+
+    mode->missFirst[i] = 0;
+    mode->missLast[i] = mode->yRes - 1;
+  }
+
+  return true;
+}
+
 void emulatorScreenChangeMode(int emulatorMode)
 {
+  if (!emulatorCreateModeTextures(&qlModes[emulatorMode])) {
+    return;
+  }
+
   emulatorCurrentMode = emulatorMode;
+  emulatorScreenRedraw();
+}
+
+// convert and present the whole screen on the next frame
+void emulatorScreenRedraw(void)
+{
+  emulatorScreenForce = true;
+  emulatorScreenPresent = true;
 }
 
 // frame counter for flash
 static int curframe = 0;
+static bool flashPhase = false;
+
+static void emulatorConvertLineMode4(const uint8_t* screenPtr,
+    uint32_t* pixelPtr32, int lineBytes)
+{
+  for (int i = 0; i < lineBytes; i += 2) {
+    uint8_t t1 = screenPtr[i];
+    uint8_t t2 = screenPtr[i + 1];
+
+    QL_LUT_COPY(pixelPtr32, qlMode4Lut[(t1 & 0xF0) | (t2 >> 4)]);
+    QL_LUT_COPY(pixelPtr32 + 4, qlMode4Lut[((t1 & 0x0F) << 4) | (t2 & 0x0F)]);
+    pixelPtr32 += 8;
+  }
+}
 
-void emulatorUpdatePixelBufferQL(uint8_t* emulatorScreenPtr,
-    uint8_t* emulatorScreenPtrEnd)
+static void emulatorConvertLineMode8(const uint8_t* screenPtr,
+    uint32_t* pixelPtr32, int lineBytes)
+{
+  for (int i = 0; i < lineBytes; i += 2) {
+    uint8_t t1 = screenPtr[i];
+    uint8_t t2 = screenPtr[i + 1];
+
+    QL_LUT_COPY(pixelPtr32, qlMode8Lut[(t1 & 0xF0) | (t2 >> 4)]);
+    QL_LUT_COPY(pixelPtr32 + 4, qlMode8Lut[((t1 & 0x0F) << 4) | (t2 & 0x0F)]);
+    pixelPtr32 += 8;
+  }
+}
+
+// flash state is reset at the start of each line
+static void emulatorConvertLineMode8Flash(const uint8_t* screenPtr,
+    uint32_t* pixelPtr32, int lineBytes)
 {
-  uint32_t* pixelPtr32 = (uint32_t*)qlModes[emulatorCurrentMode].surface->pixels;
-  int curpix = 0;
   uint32_t flashbg = 0;
   int flashon = 0;
 
-  while (emulatorScreenPtr < emulatorScreenPtrEnd) {
-    uint8_t t1 = *emulatorScreenPtr++;
-    uint8_t t2 = *emulatorScreenPtr++;
+  for (int b = 0; b < lineBytes; b += 2) {
+    uint8_t t1 = screenPtr[b];
+    uint8_t t2 = screenPtr[b + 1];
 
-    switch (emulatorCurrentMode) {
-    case 0:
-      for (int i = 6; i > -2; i -= 2) {
-        uint8_t p1 = (t1 >> i) & 0x03;
-        uint8_t p2 = (t2 >> i) & 0x03;
+    for (int i = 6; i > -2; i -= 2) {
+      uint8_t p1 = (t1 >> i) & 0x03;
+      uint8_t p2 = (t2 >> i) & 0x03;
 
-        int color = ((p1 & 2) << 1) + ((p2 & 3));
-        int flashbit = (p1 & 1);
+      int color = ((p1 & 2) << 1) + ((p2 & 3));
+      int flashbit = (p1 & 1);
 
-        uint32_t x = sdlColors[color];
+      uint32_t x = sdlColors[color];
 
-        if ((curframe & BIT(5)) && flashon) {
-          x = flashbg;
-        }
+      if (flashon) {
+        x = flashbg;
+      }
 
-        *pixelPtr32++ = x;
-        *pixelPtr32++ = x;
-
-        // flash happens after the pixel
-        if (flashbit) {
-          if (flashon == 0) {
-            flashbg = x;
-            flashon = 1;
-          } else {
-            flashon = 0;
-          }
-        }
+      *pixelPtr32++ = x;
+      *pixelPtr32++ = x;
 
-        // Handle flash end of line
-        // stride is fixed at 256 because mode 8
-        // is fixed at that size on QL and Q68
-        curpix++;
-        curpix %= 256;
-        if (curpix == 0) {
-          flashbg = 0;
+      // flash happens after the pixel
+      if (flashbit) {
+        if (flashon == 0) {
+          flashbg = x;
+          flashon = 1;
+        } else {
           flashon = 0;
         }
       }
-      break;
-    case 1:
-    case 4:
-      for (int i = 7; i > -1; i--) {
-        uint8_t p1 = (t1 >> i) & 0x01;
-        uint8_t p2 = (t2 >> i) & 0x01;
+    }
+  }
+}
+
+static bool emulatorLineHasFlash(const uint8_t* screenPtr, int lineBytes)
+{
+  uint8_t flash = 0;
 
-        int color = ((p1 & 1) << 2) + ((p2 & 1) << 1) + ((p1 & 1) & (p2 & 1));
+  for (int i = 0; i < lineBytes; i += 2) {
+    flash |= screenPtr[i];
+  }
 
-        uint32_t x = sdlColors[color];
+  return flash & 0x55;
+}
 
-        *pixelPtr32++ = x;
-      }
+// flash only shows during the on phase of the blink
+static void emulatorConvertLineQL8(const uint8_t* screenPtr,
+    uint32_t* pixelPtr32, int lineBytes)
+{
+  if (emulatorLineHasFlash(screenPtr, lineBytes)) {
+    emulatorConvertLineMode8Flash(screenPtr, pixelPtr32, lineBytes);
+  } else {
+    emulatorConvertLineMode8(screenPtr, pixelPtr32, lineBytes);
+  }
+}
+
+static void emulatorConvertLine33(const uint8_t* screenPtr,
+    uint32_t* pixelPtr32, int lineBytes)
+{
+  const uint16_t* screenPtr16 = (const uint16_t*)screenPtr;
+  const Uint32* lut = emulatorPalette->rgb16;
+
+  for (int i = 0; i < (lineBytes / 2); i++) {
+    pixelPtr32[i] = lut[screenPtr16[i]];
+  }
+}
+
+static void emulatorConvertLineAurora(const uint8_t* screenPtr,
+    uint32_t* pixelPtr32, int lineBytes)
+{
+  const Uint32* lut = emulatorPalette->aurora;
+
+  for (int i = 0; i < lineBytes; i++) {
+    pixelPtr32[i] = lut[screenPtr[i]];
+  }
+}
+
+static void emulatorRenderJob(struct emulatorScreenJob* job)
+{
+  struct qlMode* mode = job->mode;
+
+  for (int i = 0; i < job->rect.h; i++) {
+    int line = job->rect.y + i;
+
+    job->convert(job->snapshot + (line * mode->lineBytes),
+        (uint32_t*)(job->pixels + (i * job->pitch)),
+        mode->lineBytes);
+  }
+}
+
+static int emulatorRenderWorker(void* data)
+{
+  (void)data;
+
+  while (true) {
+    SDL_WaitSemaphore(emulatorRenderStart);
+
+    if (SDL_GetAtomicInt(&emulatorRenderQuit)) {
       break;
     }
+
+    emulatorRenderJob(emulatorJobBusy);
+    SDL_SignalSemaphore(emulatorRenderDone);
   }
 
-  // frame counter for flash
-  curframe++;
-  curframe %= 64;
+  return 0;
 }
 
-void emulatorUpdatePixelBuffer33(uint16_t* emulatorScreenPtr,
-    uint16_t* emulatorScreenPtrEnd)
+static void emulatorInitRenderThread(void)
 {
-  uint32_t* pixelPtr32 = (uint32_t*)qlModes[emulatorCurrentMode].surface->pixels;
+  // conversion is done inline when there is no core to spare
+  if (SDL_GetNumLogicalCPUCores() < 2) {
+    return;
+  }
 
-  while (emulatorScreenPtr < emulatorScreenPtrEnd) {
-    uint16_t pixel16 = SDL_Swap16BE(*emulatorScreenPtr++);
+  SDL_SetAtomicInt(&emulatorRenderQuit, 0);
+  emulatorRenderStart = SDL_CreateSemaphore(0);
+  emulatorRenderDone = SDL_CreateSemaphore(0);
 
-    // red
-    uint8_t red = (pixel16 & 0x07C0) >> 3;
+  if (emulatorRenderStart && emulatorRenderDone) {
+    emulatorRenderThread = SDL_CreateThread(emulatorRenderWorker,
+        "render", NULL);
+  }
 
-    // green
-    uint8_t green = (pixel16 & 0xF800) >> 8;
+  if (emulatorRenderThread == NULL) {
+    fprintf(stderr, "Failed to Create Render Thread %s\n", SDL_GetError());
+  }
+}
 
-    // blue
-    uint8_t blue = (pixel16 & 0x003E) << 2;
+void emulatorQuitScreen(void)
+{
+  emulatorScreenFlush();
+
+  if (emulatorRenderThread) {
+    SDL_SetAtomicInt(&emulatorRenderQuit, 1);
+    SDL_SignalSemaphore(emulatorRenderStart);
+    SDL_WaitThread(emulatorRenderThread, NULL);
+    emulatorRenderThread = NULL;
+  }
+
+  SDL_free(emulatorHeadlessPixels);
+  emulatorHeadlessPixels = NULL;
 
-    uint32_t pixel32 = SDL_MapRGB(
-        SDL_GetPixelFormatDetails(
-            qlModes[emulatorCurrentMode].surface->format),
-        NULL, red, green, blue);
+  SDL_DestroySemaphore(emulatorRenderStart);
+  SDL_DestroySemaphore(emulatorRenderDone);
+  emulatorRenderStart = emulatorRenderDone = NULL;
 
-    *pixelPtr32++ = pixel32;
+  for (int i = 0; i < 2; i++) {
+    SDL_free(emulatorScreenJobs[i].snapshot);
+    emulatorScreenJobs[i].snapshot = NULL;
+    emulatorScreenJobs[i].snapshotSize = 0;
   }
 }
 
-void emulatorUpdatePixelBufferAurora(uint8_t* emulatorScreenPtr,
-    uint8_t* emulatorScreenPtrEnd)
+// wait for the job in flight and hand its texture over for display
+static void emulatorScreenFlush(void)
 {
-  uint32_t* pixelPtr32 = (uint32_t*)qlModes[emulatorCurrentMode].surface->pixels;
+  struct emulatorScreenJob* job = emulatorJobBusy;
 
-  while (emulatorScreenPtr < emulatorScreenPtrEnd) {
-    uint8_t pixel8 = *emulatorScreenPtr++;
+  if (job == NULL) {
+    return;
+  }
 
-    // red
-    uint8_t red = (pixel8 & (1 << 6)) >> 4;
-    red |= pixel8 & (1 << 3) >> 2;
-    red |= pixel8 & 1;
-    red *= 35;
+  if (emulatorRenderThread) {
+    SDL_WaitSemaphore(emulatorRenderDone);
+  }
 
-    // green
-    uint8_t green = (pixel8 & (1 << 7)) >> 5;
-    green |= (pixel8 & (1 << 4)) >> 3;
-    green |= (pixel8 & (1 << 1)) >> 1;
-    green *= 35;
+  if (job->texture) {
+    SDL_UnlockTexture(job->texture);
 
-    // blue
-    uint8_t blue = (pixel8 & (1 << 5)) >> 3;
-    blue |= (pixel8 & (1 << 2)) >> 1;
-    blue |= pixel8 & 1;
-    blue *= 35;
+    emulatorShownTexture = job->texture;
+    emulatorScreenPresent = true;
+  }
+  emulatorJobBusy = NULL;
+}
 
-    uint32_t pixel32 = SDL_MapRGB(
-        SDL_GetPixelFormatDetails(
-            qlModes[emulatorCurrentMode].surface->format),
-        NULL, red, green, blue);
+static void emulatorScreenPost(struct emulatorScreenJob* job)
+{
+  void* pixels;
+
+  if (job->texture == NULL) {
+    job->pixels = (uint8_t*)(emulatorHeadlessPixels + (job->rect.y * job->rect.w));
+    job->pitch = job->rect.w * sizeof(uint32_t);
+  } else if (!SDL_LockTexture(job->texture, &job->rect, &pixels, &job->pitch)) {
+    fprintf(stderr, "Failed to Lock Texture %s\n", SDL_GetError());
+    emulatorScreenRedraw();
+    return;
+  } else {
+    job->pixels = pixels;
+  }
 
-    *pixelPtr32++ = pixel32;
+  emulatorJobBusy = job;
+
+  if (emulatorRenderThread) {
+    SDL_SignalSemaphore(emulatorRenderStart);
+  } else {
+    emulatorRenderJob(job);
   }
 }
 
 void emulatorUpdatePixelBuffer(void)
 {
-  if (SDL_MUSTLOCK(qlModes[emulatorCurrentMode].surface)) {
-    SDL_LockSurface(qlModes[emulatorCurrentMode].surface);
-  }
-
-  uint8_t* emulatorScreenPtr;
-  uint8_t* emulatorScreenPtrEnd;
+  struct qlMode* mode = &qlModes[emulatorCurrentMode];
+  void (*convert)(const uint8_t*, uint32_t*, int);
+  const uint8_t* screenPtr;
+  unsigned int chunk;
 
   switch (emulatorCurrentMode) {
   case 0:
   case 1:
-    emulatorScreenPtr = emulatorMemorySpace() + qlModes[emulatorCurrentMode].base;
-    emulatorScreenPtrEnd = emulatorScreenPtr + qlModes[emulatorCurrentMode].size;
+    screenPtr = emulatorMemorySpace() + mode->base;
+    chunk = EMU_DIRTY_QL;
 
     // handle the second QL screen
     if (emulatorSecondScreen) {
-      emulatorScreenPtr += KB(32);
-      emulatorScreenPtrEnd += KB(32);
+      screenPtr += KB(32);
+      chunk += KB(32) >> EMU_DIRTY_SHIFT;
     }
 
-    emulatorUpdatePixelBufferQL(emulatorScreenPtr,
-        emulatorScreenPtrEnd);
+    convert = emulatorCurrentMode ? emulatorConvertLineMode4 : emulatorConvertLineMode8;
     break;
   case 2:
   case 3:
   case 6:
   case 7:
-    emulatorScreenPtr = emulatorScreenSpace();
-    emulatorScreenPtrEnd = emulatorScreenPtr + qlModes[emulatorCurrentMode].size;
-    emulatorUpdatePixelBuffer33((uint16_t*)emulatorScreenPtr,
-        (uint16_t*)emulatorScreenPtrEnd);
+    screenPtr = emulatorScreenSpace();
+    chunk = EMU_DIRTY_Q68;
+    convert = emulatorConvertLine33;
     break;
   case 4:
-    emulatorScreenPtr = emulatorScreenSpace();
-    emulatorScreenPtrEnd = emulatorScreenPtr + qlModes[emulatorCurrentMode].size;
-    emulatorUpdatePixelBufferQL(emulatorScreenPtr,
-        emulatorScreenPtrEnd);
+    screenPtr = emulatorScreenSpace();
+    chunk = EMU_DIRTY_Q68;
+    convert = emulatorConvertLineMode4;
     break;
   case 5:
-    emulatorScreenPtr = emulatorScreenSpace();
-    emulatorScreenPtrEnd = emulatorScreenPtr + qlModes[emulatorCurrentMode].size;
-    emulatorUpdatePixelBufferAurora(emulatorScreenPtr,
-        emulatorScreenPtrEnd);
+    screenPtr = emulatorScreenSpace();
+    chunk = EMU_DIRTY_Q68;
+    convert = emulatorConvertLineAurora;
     break;
   default:
     fprintf(stderr, "Unsupported Screen Mode\n");
+    return;
+  }
+
+  if (emulatorSecondScreen != emulatorLastSecondScreen) {
+    emulatorLastSecondScreen = emulatorSecondScreen;
+    emulatorScreenRedraw();
+  }
+
+  // a change of blink phase redraws the flashing mode 8 screen
+  if (emulatorCurrentMode <= 1) {
+    bool phase = (curframe & BIT(5)) != 0;
+
+    if ((emulatorCurrentMode == 0) && (phase != flashPhase)) {
+      emulatorScreenRedraw();
+    }
+    flashPhase = phase;
+
+    if ((emulatorCurrentMode == 0) && flashPhase) {
+      convert = emulatorConvertLineQL8;
+    }
+
+    // frame counter for flash
+    curframe++;
+    curframe %= 64;
+  }
+
+  int lines = SDL_min(mode->yRes, (int)(mode->size / mode->lineBytes));
+  int lineChunks = mode->lineBytes >> EMU_DIRTY_SHIFT;
+  uint32_t lineMask = (1U << lineChunks) - 1;
+  size_t size = (size_t)lines * mode->lineBytes;
+  int first = lines;
+  int last = -1;
+
+  for (int line = 0; line < lines; line++) {
+    unsigned int lineChunk = chunk + (line * lineChunks);
+
+    if (emulatorScreenForce || (emulatorScreenDirty[lineChunk / 32] & (lineMask << (lineChunk % 32)))) {
+      first = SDL_min(first, line);
+      last = line;
+    }
   }
 
-  if (SDL_MUSTLOCK(qlModes[emulatorCurrentMode].surface)) {
-    SDL_UnlockSurface(qlModes[emulatorCurrentMode].surface);
+  SDL_memset(&emulatorScreenDirty[chunk / 32], 0,
+      ((lines * lineChunks + 31) / 32) * sizeof(uint32_t));
+
+  if (emulatorScreenForce) {
+    mode->missFirst[0] = mode->missFirst[1] = 0;
+    mode->missLast[0] = mode->missLast[1] = lines - 1;
+    emulatorScreenForce = false;
+  }
+
+  // the texture being filled also catches up with its partner
+  int fill = mode->next;
+  int other = fill ^ 1;
+
+  if (last >= 0) {
+    mode->missFirst[other] = SDL_min(mode->missFirst[other], first);
+    mode->missLast[other] = SDL_max(mode->missLast[other], last);
+  }
+
+  first = SDL_min(first, mode->missFirst[fill]);
+  last = SDL_max(last, SDL_min(mode->missLast[fill], lines - 1));
+  mode->missFirst[fill] = lines;
+  mode->missLast[fill] = -1;
+
+  // upload the previous frame while this one is converted
+  emulatorScreenFlush();
+
+  if (last < first) {
+    return;
   }
+
+  // fill whichever job is not being converted
+  struct emulatorScreenJob* job = &emulatorScreenJobs[0];
+  if (job == emulatorJobBusy) {
+    job = &emulatorScreenJobs[1];
+  }
+
+  if (job->snapshotSize < size) {
+    uint8_t* snapshot = SDL_realloc(job->snapshot, size);
+
+    if (snapshot == NULL) {
+      fprintf(stderr, "Failed to allocate screen snapshot\n");
+      return;
+    }
+
+    job->snapshot = snapshot;
+    job->snapshotSize = size;
+  }
+
+  job->mode = mode;
+  job->convert = convert;
+  job->texture = mode->texture[fill];
+  job->rect.x = 0;
+  job->rect.y = first;
+  job->rect.w = mode->xRes;
+  job->rect.h = last + 1 - first;
+
+  SDL_memcpy(job->snapshot + (first * mode->lineBytes),
+      screenPtr + (first * mode->lineBytes),
+      (size_t)job->rect.h * mode->lineBytes);
+
+  mode->next = other;
+  emulatorScreenPost(job);
 }
 
 void emulatorRenderScreen(void)
 {
-  SDL_UpdateTexture(qlModes[emulatorCurrentMode].texture, NULL,
-      qlModes[emulatorCurrentMode].surface->pixels,
-      qlModes[emulatorCurrentMode].surface->pitch);
+  if (emulatorRenderThread == NULL) {
+    emulatorScreenFlush();
+  }
+
+  // nothing has changed since the last frame
+  if (!emulatorScreenPresent || (emulatorShownTexture == NULL)) {
+    return;
+  }
+
   SDL_RenderClear(emulatorRenderer);
-  SDL_RenderTexture(emulatorRenderer,
-      qlModes[emulatorCurrentMode].texture, NULL, NULL);
+  SDL_RenderTexture(emulatorRenderer, emulatorShownTexture, NULL, NULL);
   SDL_RenderPresent(emulatorRenderer);
+
+  emulatorScreenPresent = false;
 }
 
 void emulatorToggleFullScreen(void)
@@ -373,6 +866,10 @@ void emulatorSetRefresh(bool fast)
 
   emulatorScreenFast = fast;
 
+  if (emulatorScreenHeadless) {
+    return;
+  }
+
   if (fast) {
     SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE,
         fastfps);
@@ -0,0 +1,1007 @@
+/*
+ * Copyright (c) 2026 Graeme Gregory
+ *
+ * SPDX: GPL-2.0-only
+ */
+
+// fallocate() for punching holes
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "emulator_options.h"
+#include "emulator_sdimage.h"
+#include "emulator_sdoverlay.h"
+#include "uthash.h"
+#include "utlist.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SD_IMAGE_MMAP
+#endif
+
+#ifdef __linux__
+#include <linux/falloc.h>
+#define SD_IMAGE_PUNCH
+#endif
+
+/*
+ * SD card images. Each image has an LRU cache of sectors in front of the
+ * host file. Sectors missing from the cache are fetched in one host read
+ * per run, and dirty sectors are written back in sector order with each
+ * run of consecutive sectors as a single write. Write back happens when
+ * the card is deselected, when the guest goes idle, on shift+F7 and on
+ * exit. The cache size comes from sd-cache and is never less than one
+ * run, so multi-block transfers are batched whatever it is set to. Only
+ * an image whose cache cannot be allocated passes every access straight
+ * through to the file.
+ *
+ * With sd-mmap the image is mapped instead and blocks are copied to and
+ * from the mapping with no system calls at all. Dirty pages go back to
+ * the file with msync according to sd-msync, always on exit and on
+ * shift+F7, and also on card release or at most once a second.
+ *
+ * With sd-async a worker thread per image does the prefetches and the
+ * write back, the emulation only waits when it needs a sector the
+ * worker is still reading. Whoever holds ioLock owns the host file and
+ * is the only one allowed to add, evict or modify sectors, cacheLock
+ * covers the index and LRU list so cache hits never wait for the disk.
+ * Locks are taken in that order, SDL mutexes are recursive.
+ *
+ * An image may instead be a copy-on-write overlay of a shared base, see
+ * emulator_sdoverlay.c. Overlays always go through the cache so the
+ * overlay only ever sees whole sectors, sd-overlay-exit decides whether
+ * the delta is kept, committed to the base or discarded on exit.
+ *
+ * Erased ranges are trimmed, plain images get holes punched in them
+ * where the host supports it and overlays drop the sectors from the
+ * delta, cached copies are then read again.
+ */
+
+// most sectors moved in one host transfer
+#define SD_IMAGE_RUN 64
+
+enum {
+  SD_IMAGE_SYNC_EXIT,
+  SD_IMAGE_SYNC_RELEASE,
+  SD_IMAGE_SYNC_PERIODIC,
+};
+
+#define SD_IMAGE_SYNC_PERIOD_MS 1000
+
+enum {
+  SD_IMAGE_OVERLAY_KEEP,
+  SD_IMAGE_OVERLAY_COMMIT,
+  SD_IMAGE_OVERLAY_DISCARD,
+};
+
+// outstanding prefetches, the oldest is dropped when full
+#define SD_IMAGE_QUEUE 16
+
+typedef struct sdimage_sector {
+  uint64_t sector;
+  bool dirty;
+  struct sdimage_sector* prev;
+  struct sdimage_sector* next;
+  UT_hash_handle hh;
+  uint8_t data[SD_IMAGE_SECTOR];
+} sdimage_sector_t;
+
+struct emulator_sdimage {
+  char* file;
+  SDL_IOStream* io;
+  emulator_sdoverlay_t* overlay;
+  uint64_t sectors;
+
+  sdimage_sector_t* pool;
+  int capacity;
+  int used;
+  int dirty;
+  sdimage_sector_t* index;
+  // most recently used first
+  sdimage_sector_t* lru;
+
+  // mapped images bypass the cache
+  uint8_t* map;
+  size_t mapSize;
+  bool mapDirty;
+  int syncPolicy;
+  uint64_t mapSynced;
+
+  // background I/O, all NULL when synchronous
+  SDL_Mutex* ioLock;
+  SDL_Mutex* cacheLock;
+  SDL_Mutex* queueLock;
+  SDL_Condition* wake;
+  SDL_Thread* worker;
+  bool quit;
+  bool flushWanted;
+  struct {
+    uint64_t first;
+    uint64_t end;
+  } queue[SD_IMAGE_QUEUE];
+  int queueHead;
+  int queueCount;
+
+  emulator_sdimage_stats_t stats;
+  // separate so a fill can evict and write back on the way
+  uint8_t fillRun[SD_IMAGE_RUN * SD_IMAGE_SECTOR];
+  uint8_t flushRun[SD_IMAGE_RUN * SD_IMAGE_SECTOR];
+
+  struct emulator_sdimage* next;
+};
+
+static emulator_sdimage_t* sdImages = NULL;
+static emulator_sdimage_stats_t sdClosedStats;
+
+static bool sdImageHostRead(emulator_sdimage_t* img, uint64_t offset,
+    void* data, size_t size)
+{
+  if (img->overlay) {
+    return sdOverlayRead(img->overlay, offset / SD_IMAGE_SECTOR, data,
+        size / SD_IMAGE_SECTOR);
+  }
+
+  if (SDL_SeekIO(img->io, offset, SDL_IO_SEEK_SET) < 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: failed to seek %" SDL_PRIu64, img->file, offset);
+    return false;
+  }
+
+  size_t resRead = SDL_ReadIO(img->io, data, size);
+  if (resRead != size) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: failed to read %zu bytes at %" SDL_PRIu64, img->file, size,
+        offset);
+    return false;
+  }
+
+  return true;
+}
+
+static bool sdImageHostWrite(emulator_sdimage_t* img, uint64_t offset,
+    const void* data, size_t size)
+{
+  if (img->overlay) {
+    return sdOverlayWrite(img->overlay, offset / SD_IMAGE_SECTOR, data,
+        size / SD_IMAGE_SECTOR);
+  }
+
+  if (SDL_SeekIO(img->io, offset, SDL_IO_SEEK_SET) < 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: failed to seek %" SDL_PRIu64, img->file, offset);
+    return false;
+  }
+
+  size_t resWrite = SDL_WriteIO(img->io, data, size);
+  if (resWrite != size) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: failed to write %zu bytes at %" SDL_PRIu64, img->file, size,
+        offset);
+    return false;
+  }
+
+  return true;
+}
+
+static void sdImageHostFlush(emulator_sdimage_t* img)
+{
+  if (img->overlay) {
+    sdOverlayFlush(img->overlay);
+  } else {
+    SDL_FlushIO(img->io);
+  }
+}
+
+static bool sdImageWriteBack(emulator_sdimage_t* img);
+
+static sdimage_sector_t* sdImageLookup(emulator_sdimage_t* img,
+    uint64_t sector)
+{
+  sdimage_sector_t* entry;
+
+  HASH_FIND(hh, img->index, &sector, sizeof(sector), entry);
+
+  return entry;
+}
+
+static sdimage_sector_t* sdImageFind(emulator_sdimage_t* img,
+    uint64_t sector)
+{
+  sdimage_sector_t* entry = sdImageLookup(img, sector);
+
+  if (entry && (img->lru != entry)) {
+    DL_DELETE(img->lru, entry);
+    DL_PREPEND(img->lru, entry);
+  }
+
+  return entry;
+}
+
+static sdimage_sector_t* sdImageAllocate(emulator_sdimage_t* img,
+    uint64_t sector)
+{
+  sdimage_sector_t* entry;
+
+  if (img->used < img->capacity) {
+    entry = &img->pool[img->used++];
+  } else {
+    // the list head's prev is the least recently used sector
+    entry = img->lru->prev;
+
+    // write back everything now so it goes out in runs
+    if (entry->dirty && !sdImageWriteBack(img)) {
+      return NULL;
+    }
+
+    HASH_DELETE(hh, img->index, entry);
+    DL_DELETE(img->lru, entry);
+  }
+
+  entry->sector = sector;
+  entry->dirty = false;
+  HASH_ADD(hh, img->index, sector, sizeof(entry->sector), entry);
+  DL_PREPEND(img->lru, entry);
+
+  return entry;
+}
+
+// cache the uncached sectors from first on, returns how many were read,
+// the caller holds ioLock and cacheLock
+static size_t sdImageFill(emulator_sdimage_t* img, uint64_t first,
+    size_t count)
+{
+  count = SDL_min(count, (size_t)SD_IMAGE_RUN);
+  count = SDL_min(count, (size_t)SDL_max(img->capacity / 2, 1));
+  if (first >= img->sectors) {
+    return 0;
+  }
+  count = SDL_min(count, img->sectors - first);
+
+  for (size_t i = 1; i < count; i++) {
+    if (sdImageLookup(img, first + i)) {
+      count = i;
+      break;
+    }
+  }
+
+  // nothing can be added or evicted meanwhile as we hold ioLock
+  SDL_UnlockMutex(img->cacheLock);
+  bool ok = sdImageHostRead(img, first * SD_IMAGE_SECTOR, img->fillRun,
+      count * SD_IMAGE_SECTOR);
+  SDL_LockMutex(img->cacheLock);
+
+  if (!ok) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    sdimage_sector_t* entry = sdImageAllocate(img, first + i);
+
+    if (!entry) {
+      return i;
+    }
+
+    SDL_memcpy(entry->data, &img->fillRun[i * SD_IMAGE_SECTOR], SD_IMAGE_SECTOR);
+  }
+
+  return count;
+}
+
+// the caller holds ioLock and cacheLock
+static void sdImageFillRange(emulator_sdimage_t* img, uint64_t sector,
+    uint64_t end)
+{
+  // never prefetch so much it pushes itself out again
+  end = SDL_min(end, sector + SDL_max(img->capacity / 2, 1));
+  end = SDL_min(end, img->sectors);
+  while (sector < end) {
+    if (sdImageLookup(img, sector)) {
+      sector++;
+      continue;
+    }
+
+    size_t count = sdImageFill(img, sector, end - sector);
+    if (!count) {
+      return;
+    }
+    sector += count;
+  }
+}
+
+static int SDLCALL sdImageWorker(void* data)
+{
+  emulator_sdimage_t* img = data;
+
+  SDL_LockMutex(img->queueLock);
+  while (!img->quit) {
+    if (img->queueCount) {
+      uint64_t first = img->queue[img->queueHead].first;
+      uint64_t end = img->queue[img->queueHead].end;
+
+      img->queueHead = (img->queueHead + 1) % SD_IMAGE_QUEUE;
+      img->queueCount--;
+      SDL_UnlockMutex(img->queueLock);
+
+      SDL_LockMutex(img->ioLock);
+      SDL_LockMutex(img->cacheLock);
+      sdImageFillRange(img, first, end);
+      SDL_UnlockMutex(img->cacheLock);
+      SDL_UnlockMutex(img->ioLock);
+
+      SDL_LockMutex(img->queueLock);
+    } else if (img->flushWanted) {
+      img->flushWanted = false;
+      SDL_UnlockMutex(img->queueLock);
+
+      SDL_LockMutex(img->ioLock);
+      sdImageWriteBack(img);
+      SDL_UnlockMutex(img->ioLock);
+
+      SDL_LockMutex(img->queueLock);
+    } else {
+      SDL_WaitCondition(img->wake, img->queueLock);
+    }
+  }
+  SDL_UnlockMutex(img->queueLock);
+
+  return 0;
+}
+
+static bool sdImageStartWorker(emulator_sdimage_t* img)
+{
+  img->ioLock = SDL_CreateMutex();
+  img->cacheLock = SDL_CreateMutex();
+  img->queueLock = SDL_CreateMutex();
+  img->wake = SDL_CreateCondition();
+
+  if (img->ioLock && img->cacheLock && img->queueLock && img->wake) {
+    img->worker = SDL_CreateThread(sdImageWorker, "sdimage", img);
+  }
+
+  return img->worker != NULL;
+}
+
+static void sdImageStopWorker(emulator_sdimage_t* img)
+{
+  if (img->worker) {
+    SDL_LockMutex(img->queueLock);
+    img->quit = true;
+    SDL_SignalCondition(img->wake);
+    SDL_UnlockMutex(img->queueLock);
+
+    SDL_WaitThread(img->worker, NULL);
+    img->worker = NULL;
+  }
+
+  SDL_DestroyCondition(img->wake);
+  SDL_DestroyMutex(img->queueLock);
+  SDL_DestroyMutex(img->cacheLock);
+  SDL_DestroyMutex(img->ioLock);
+  img->wake = NULL;
+  img->queueLock = img->cacheLock = img->ioLock = NULL;
+}
+
+static void sdImageQueue(emulator_sdimage_t* img, uint64_t first,
+    uint64_t end)
+{
+  SDL_LockMutex(img->queueLock);
+
+  if (img->queueCount == SD_IMAGE_QUEUE) {
+    img->queueHead = (img->queueHead + 1) % SD_IMAGE_QUEUE;
+    img->queueCount--;
+  }
+
+  int tail = (img->queueHead + img->queueCount) % SD_IMAGE_QUEUE;
+  img->queue[tail].first = first;
+  img->queue[tail].end = end;
+  img->queueCount++;
+
+  SDL_SignalCondition(img->wake);
+  SDL_UnlockMutex(img->queueLock);
+}
+
+#ifdef SD_IMAGE_MMAP
+static bool sdImageMapOpen(emulator_sdimage_t* img)
+{
+  struct stat st;
+  int fd = open(img->file, O_RDWR);
+
+  if (fd < 0) {
+    return false;
+  }
+
+  if ((fstat(fd, &st) != 0) || (st.st_size <= 0)
+      || ((uint64_t)st.st_size > SIZE_MAX)) {
+    close(fd);
+    return false;
+  }
+
+  // the mapping holds its own reference to the file
+  void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+      0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    return false;
+  }
+
+  img->map = map;
+  img->mapSize = st.st_size;
+  img->mapSynced = SDL_GetTicks();
+
+  return true;
+}
+
+static bool sdImageMapSync(emulator_sdimage_t* img, bool force)
+{
+  uint64_t now = SDL_GetTicks();
+
+  if (!img->mapDirty) {
+    return true;
+  }
+
+  if (!force) {
+    if (img->syncPolicy == SD_IMAGE_SYNC_EXIT) {
+      return true;
+    }
+
+    if ((img->syncPolicy == SD_IMAGE_SYNC_PERIODIC)
+        && ((now - img->mapSynced) < SD_IMAGE_SYNC_PERIOD_MS)) {
+      return true;
+    }
+  }
+
+  img->mapDirty = false;
+  img->mapSynced = now;
+
+  if (msync(img->map, img->mapSize, force ? MS_SYNC : MS_ASYNC) != 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s: msync failed",
+        img->file);
+    return false;
+  }
+
+  return true;
+}
+#endif
+
+// overlay names a delta file to keep the image's changes in, or is empty
+emulator_sdimage_t* sdImageOpen(const char* file, const char* overlay)
+{
+  SDL_IOStream* io = NULL;
+  emulator_sdoverlay_t* ov = NULL;
+
+  if (overlay && *overlay) {
+    ov = sdOverlayOpen(file, overlay);
+    if (!ov) {
+      return NULL;
+    }
+  } else {
+    io = SDL_IOFromFile(file, "r+b");
+    if (!io) {
+      return NULL;
+    }
+  }
+
+  emulator_sdimage_t* img = SDL_calloc(1, sizeof(*img));
+  if (!img) {
+    sdOverlayClose(ov);
+    SDL_CloseIO(io);
+    return NULL;
+  }
+
+  img->file = SDL_strdup(file);
+  img->io = io;
+  img->overlay = ov;
+  if (ov) {
+    img->sectors = sdOverlaySectors(ov);
+  } else {
+    img->sectors = SDL_max(SDL_GetIOSize(io), 0) / SD_IMAGE_SECTOR;
+  }
+
+#ifdef SD_IMAGE_MMAP
+  if (!ov && emulatorOptionInt("sd-mmap")) {
+    img->syncPolicy = emulatorOptionInt("sd-msync");
+
+    if (sdImageMapOpen(img)) {
+      LL_PREPEND(sdImages, img);
+      return img;
+    }
+
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: failed to map image, using the cache", file);
+  }
+#endif
+
+  int cacheKb = SDL_max(emulatorOptionInt("sd-cache"), 0);
+  img->capacity = SDL_max(cacheKb * (1024 / SD_IMAGE_SECTOR), SD_IMAGE_RUN);
+  cacheKb = img->capacity / (1024 / SD_IMAGE_SECTOR);
+  img->pool = SDL_calloc(img->capacity, sizeof(sdimage_sector_t));
+  if (!img->pool) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: no memory for a %dKB cache, running uncached", file, cacheKb);
+    img->capacity = 0;
+  }
+
+  if (ov && !img->capacity) {
+    sdOverlayClose(ov);
+    SDL_free(img->file);
+    SDL_free(img);
+    return NULL;
+  }
+
+  if (img->capacity && emulatorOptionInt("sd-async")
+      && !sdImageStartWorker(img)) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: failed to start the I/O thread: %s", file, SDL_GetError());
+    sdImageStopWorker(img);
+  }
+
+  LL_PREPEND(sdImages, img);
+
+  return img;
+}
+
+void sdImageClose(emulator_sdimage_t* img)
+{
+  if (!img) {
+    return;
+  }
+
+  sdImageStopWorker(img);
+  sdImageWriteBack(img);
+  sdImageHostFlush(img);
+
+  if (img->overlay) {
+    switch (emulatorOptionInt("sd-overlay-exit")) {
+    case SD_IMAGE_OVERLAY_COMMIT:
+      sdOverlayCommit(img->overlay);
+      break;
+    case SD_IMAGE_OVERLAY_DISCARD:
+      sdOverlayDiscard(img->overlay);
+      break;
+    default:
+      break;
+    }
+    sdOverlayClose(img->overlay);
+  }
+
+#ifdef SD_IMAGE_MMAP
+  if (img->map) {
+    sdImageMapSync(img, true);
+    munmap(img->map, img->mapSize);
+  }
+#endif
+
+  if (img->capacity) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: %" SDL_PRIu64 " hits, %" SDL_PRIu64 " misses, %" SDL_PRIu64
+        " sectors written back",
+        img->file, img->stats.hits, img->stats.misses,
+        img->stats.writebacks);
+  }
+
+  sdClosedStats.hits += img->stats.hits;
+  sdClosedStats.misses += img->stats.misses;
+  sdClosedStats.writebacks += img->stats.writebacks;
+
+  LL_DELETE(sdImages, img);
+  HASH_CLEAR(hh, img->index);
+  SDL_free(img->pool);
+  if (img->io) {
+    SDL_CloseIO(img->io);
+  }
+  SDL_free(img->file);
+  SDL_free(img);
+}
+
+void sdImageCloseAll(void)
+{
+  while (sdImages) {
+    sdImageClose(sdImages);
+  }
+}
+
+bool sdImageRead(emulator_sdimage_t* img, uint64_t offset, void* data,
+    size_t size)
+{
+  uint8_t* dst = data;
+
+  if ((offset + size) > (img->sectors * SD_IMAGE_SECTOR)) {
+    return false;
+  }
+
+  if (img->map) {
+    SDL_memcpy(data, &img->map[offset], size);
+    return true;
+  }
+
+  if (!img->capacity) {
+    return sdImageHostRead(img, offset, data, size);
+  }
+
+  // hits only need the cache, a miss waits for the file
+  bool haveIo = false;
+  bool ok = true;
+
+  SDL_LockMutex(img->cacheLock);
+  while (size) {
+    uint64_t sector = offset / SD_IMAGE_SECTOR;
+    size_t skip = offset % SD_IMAGE_SECTOR;
+    size_t len = SDL_min(size, SD_IMAGE_SECTOR - skip);
+
+    sdimage_sector_t* entry = sdImageFind(img, sector);
+    if (!entry && !haveIo) {
+      // the worker may be bringing it in right now
+      SDL_UnlockMutex(img->cacheLock);
+      SDL_LockMutex(img->ioLock);
+      SDL_LockMutex(img->cacheLock);
+      haveIo = true;
+      continue;
+    }
+
+    if (entry) {
+      img->stats.hits++;
+    } else {
+      img->stats.misses++;
+      size_t wanted = (skip + size + SD_IMAGE_SECTOR - 1) / SD_IMAGE_SECTOR;
+
+      if (!sdImageFill(img, sector, wanted)) {
+        ok = false;
+        break;
+      }
+      entry = sdImageFind(img, sector);
+    }
+
+    SDL_memcpy(dst, &entry->data[skip], len);
+    dst += len;
+    offset += len;
+    size -= len;
+  }
+  SDL_UnlockMutex(img->cacheLock);
+
+  if (haveIo) {
+    SDL_UnlockMutex(img->ioLock);
+  }
+
+  return ok;
+}
+
+// only the I/O thread makes a read wait, without it reads are always ready
+bool sdImageReady(emulator_sdimage_t* img, uint64_t offset, size_t size)
+{
+  bool ready = true;
+
+  if (!img->worker) {
+    return true;
+  }
+
+  SDL_LockMutex(img->cacheLock);
+  for (uint64_t sector = offset / SD_IMAGE_SECTOR;
+      sector < ((offset + size + SD_IMAGE_SECTOR - 1) / SD_IMAGE_SECTOR);
+      sector++) {
+    if (!sdImageLookup(img, sector)) {
+      ready = false;
+      break;
+    }
+  }
+  SDL_UnlockMutex(img->cacheLock);
+
+  return ready;
+}
+
+uint64_t sdImageSectors(emulator_sdimage_t* img)
+{
+  return img->sectors;
+}
+
+// hand the range back to the host file system, it reads back as zeros
+bool sdImagePunchHole(const char* file, uint64_t offset, uint64_t size)
+{
+#ifdef SD_IMAGE_PUNCH
+  int fd = open(file, O_RDWR);
+  if (fd < 0) {
+    return false;
+  }
+
+  int res = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+      offset, size);
+  close(fd);
+
+  return res == 0;
+#else
+  (void)file;
+  (void)offset;
+  (void)size;
+  return false;
+#endif
+}
+
+// whole sectors only, anything the host keeps stays readable as before
+bool sdImageTrim(emulator_sdimage_t* img, uint64_t offset, uint64_t size)
+{
+  uint64_t first = offset / SD_IMAGE_SECTOR;
+  uint64_t end = (offset + size) / SD_IMAGE_SECTOR;
+  bool ok = true;
+
+  if ((offset % SD_IMAGE_SECTOR) || (end > img->sectors) || (first >= end)) {
+    return false;
+  }
+
+  SDL_LockMutex(img->ioLock);
+  SDL_LockMutex(img->cacheLock);
+
+  // no point writing back what is about to go
+  sdimage_sector_t* entry;
+  DL_FOREACH(img->lru, entry)
+  {
+    if ((entry->sector >= first) && (entry->sector < end) && entry->dirty) {
+      entry->dirty = false;
+      img->dirty--;
+    }
+  }
+
+  if (img->overlay) {
+    ok = sdOverlayTrim(img->overlay, first, end - first);
+  } else {
+    if (img->io) {
+      SDL_FlushIO(img->io);
+    }
+    sdImagePunchHole(img->file, first * SD_IMAGE_SECTOR,
+        (end - first) * SD_IMAGE_SECTOR);
+  }
+
+  DL_FOREACH(img->lru, entry)
+  {
+    if ((entry->sector >= first) && (entry->sector < end)
+        && !sdImageHostRead(img, entry->sector * SD_IMAGE_SECTOR,
+            entry->data, SD_IMAGE_SECTOR)) {
+      ok = false;
+    }
+  }
+
+  SDL_UnlockMutex(img->cacheLock);
+  SDL_UnlockMutex(img->ioLock);
+
+  return ok;
+}
+
+bool sdImageWrite(emulator_sdimage_t* img, uint64_t offset,
+    const void* data, size_t size)
+{
+  const uint8_t* src = data;
+
+  if ((offset + size) > (img->sectors * SD_IMAGE_SECTOR)) {
+    return false;
+  }
+
+  if (img->map) {
+    SDL_memcpy(&img->map[offset], data, size);
+    img->mapDirty = true;
+    return true;
+  }
+
+  if (!img->capacity) {
+    return sdImageHostWrite(img, offset, data, size);
+  }
+
+  bool ok = true;
+
+  SDL_LockMutex(img->ioLock);
+  SDL_LockMutex(img->cacheLock);
+  while (size) {
+    uint64_t sector = offset / SD_IMAGE_SECTOR;
+    size_t skip = offset % SD_IMAGE_SECTOR;
+    size_t len = SDL_min(size, SD_IMAGE_SECTOR - skip);
+
+    sdimage_sector_t* entry = sdImageFind(img, sector);
+    if (entry) {
+      img->stats.hits++;
+    } else {
+      img->stats.misses++;
+
+      // only a partial sector needs the old contents
+      if (len < SD_IMAGE_SECTOR) {
+        if (sdImageFill(img, sector, 1)) {
+          entry = sdImageFind(img, sector);
+        }
+      } else {
+        entry = sdImageAllocate(img, sector);
+      }
+
+      if (!entry) {
+        ok = false;
+        break;
+      }
+    }
+
+    SDL_memcpy(&entry->data[skip], src, len);
+    if (!entry->dirty) {
+      entry->dirty = true;
+      img->dirty++;
+    }
+
+    src += len;
+    offset += len;
+    size -= len;
+  }
+  SDL_UnlockMutex(img->cacheLock);
+  SDL_UnlockMutex(img->ioLock);
+
+  return ok;
+}
+
+void sdImagePrefetch(emulator_sdimage_t* img, uint64_t offset, size_t size)
+{
+  if (!img) {
+    return;
+  }
+
+#ifdef SD_IMAGE_MMAP
+  if (img->map) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(page - 1);
+    uint64_t end = SDL_min(offset + size, img->mapSize);
+
+    if (end > start) {
+      madvise(&img->map[start], end - start, MADV_WILLNEED);
+    }
+    return;
+  }
+#endif
+
+  if (!img->capacity) {
+    return;
+  }
+
+  uint64_t sector = offset / SD_IMAGE_SECTOR;
+  uint64_t end = (offset + size + SD_IMAGE_SECTOR - 1) / SD_IMAGE_SECTOR;
+
+  if (img->worker) {
+    sdImageQueue(img, sector, end);
+    return;
+  }
+
+  sdImageFillRange(img, sector, end);
+}
+
+static int SDLCALL sdImageCompare(const void* a, const void* b)
+{
+  const sdimage_sector_t* left = *(sdimage_sector_t* const*)a;
+  const sdimage_sector_t* right = *(sdimage_sector_t* const*)b;
+
+  return (left->sector > right->sector) - (left->sector < right->sector);
+}
+
+// the caller holds ioLock, so sectors can only move in the LRU list
+static bool sdImageWriteBack(emulator_sdimage_t* img)
+{
+  if (!img->dirty) {
+    return true;
+  }
+
+  sdimage_sector_t** dirty = SDL_malloc(img->dirty * sizeof(*dirty));
+  if (!dirty) {
+    return false;
+  }
+
+  int count = 0;
+  sdimage_sector_t* entry;
+  SDL_LockMutex(img->cacheLock);
+  DL_FOREACH(img->lru, entry)
+  {
+    if (entry->dirty) {
+      dirty[count++] = entry;
+    }
+  }
+  SDL_UnlockMutex(img->cacheLock);
+
+  SDL_qsort(dirty, count, sizeof(*dirty), sdImageCompare);
+
+  bool ok = true;
+  for (int i = 0; i < count;) {
+    int run = 1;
+
+    while (((i + run) < count) && (run < SD_IMAGE_RUN)
+        && (dirty[i + run]->sector == (dirty[i]->sector + run))) {
+      run++;
+    }
+
+    for (int j = 0; j < run; j++) {
+      SDL_memcpy(&img->flushRun[j * SD_IMAGE_SECTOR], dirty[i + j]->data,
+          SD_IMAGE_SECTOR);
+    }
+
+    if (sdImageHostWrite(img, dirty[i]->sector * SD_IMAGE_SECTOR, img->flushRun,
+            run * SD_IMAGE_SECTOR)) {
+      for (int j = 0; j < run; j++) {
+        dirty[i + j]->dirty = false;
+      }
+      img->dirty -= run;
+      img->stats.writebacks += run;
+    } else {
+      ok = false;
+    }
+
+    i += run;
+  }
+
+  SDL_free(dirty);
+  sdImageHostFlush(img);
+
+  return ok;
+}
+
+bool sdImageFlush(emulator_sdimage_t* img)
+{
+  if (!img) {
+    return true;
+  }
+
+#ifdef SD_IMAGE_MMAP
+  if (img->map) {
+    return sdImageMapSync(img, false);
+  }
+#endif
+
+  if (img->worker) {
+    SDL_LockMutex(img->queueLock);
+    img->flushWanted = true;
+    SDL_SignalCondition(img->wake);
+    SDL_UnlockMutex(img->queueLock);
+    return true;
+  }
+
+  return sdImageWriteBack(img);
+}
+
+void sdImageFlushAll(void)
+{
+  emulator_sdimage_t* img;
+
+  LL_FOREACH(sdImages, img)
+  {
+    sdImageFlush(img);
+  }
+}
+
+void sdImageSyncAll(void)
+{
+  emulator_sdimage_t* img;
+
+  LL_FOREACH(sdImages, img)
+  {
+    SDL_LockMutex(img->ioLock);
+    sdImageWriteBack(img);
+    SDL_UnlockMutex(img->ioLock);
+#ifdef SD_IMAGE_MMAP
+    if (img->map) {
+      sdImageMapSync(img, true);
+    }
+#endif
+  }
+}
+
+void sdImageStats(emulator_sdimage_stats_t* stats)
+{
+  emulator_sdimage_t* img;
+
+  *stats = sdClosedStats;
+  LL_FOREACH(sdImages, img)
+  {
+    SDL_LockMutex(img->ioLock);
+    SDL_LockMutex(img->cacheLock);
+    stats->hits += img->stats.hits;
+    stats->misses += img->stats.misses;
+    stats->writebacks += img->stats.writebacks;
+    SDL_UnlockMutex(img->cacheLock);
+    SDL_UnlockMutex(img->ioLock);
+  }
+}
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2026 Graeme Gregory
+ *
+ * SPDX: GPL-2.0-only
+ */
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "emulator_sdimage.h"
+#include "emulator_sdoverlay.h"
+
+/*
+ * Copy-on-write SD images, many emulators can share one read-only base
+ * image with each writing only to its own sparse delta file. The delta
+ * starts with a header, then a bitmap of the sectors it holds and an
+ * index giving each cluster of the base its slot in the delta. Slots are
+ * allocated as clusters are first written, sectors never written inside
+ * a slot stay holes in the file and are read from the base. Data goes to
+ * the delta straight away, the bitmap and index on each flush. Trimmed
+ * sectors are dropped from the bitmap and their space in the delta
+ * punched out, a cluster left empty loses its index entry.
+ *
+ * All values are little endian.
+ */
+#define OVERLAY_MAGIC "SDOVRLAY"
+#define OVERLAY_VERSION 1
+#define OVERLAY_HEADER SD_IMAGE_SECTOR
+// sectors per cluster, the unit delta space is allocated in
+#define OVERLAY_CLUSTER 64
+#define OVERLAY_CLUSTER_BYTES ((uint64_t)OVERLAY_CLUSTER * SD_IMAGE_SECTOR)
+
+#define OVERLAY_ROUND(x) \
+  ((((x) + SD_IMAGE_SECTOR - 1) / SD_IMAGE_SECTOR) * SD_IMAGE_SECTOR)
+
+struct emulator_sdoverlay {
+  char* baseFile;
+  char* deltaFile;
+  SDL_IOStream* base;
+  SDL_IOStream* delta;
+  uint64_t sectors;
+  uint64_t clusters;
+  uint32_t slots;
+
+  // sector bitmap followed by the cluster index, as in the file
+  uint8_t* meta;
+  size_t bitmapBytes;
+  size_t metaBytes;
+  bool* metaDirty;
+  bool headerDirty;
+
+  uint8_t run[OVERLAY_CLUSTER * SD_IMAGE_SECTOR];
+};
+
+static void sdOverlayPut32(uint8_t* buf, uint32_t val)
+{
+  for (int i = 0; i < 4; i++) {
+    buf[i] = val >> (i * 8);
+  }
+}
+
+static uint32_t sdOverlayGet32(const uint8_t* buf)
+{
+  uint32_t val = 0;
+
+  for (int i = 0; i < 4; i++) {
+    val |= (uint32_t)buf[i] << (i * 8);
+  }
+
+  return val;
+}
+
+static void sdOverlayPut64(uint8_t* buf, uint64_t val)
+{
+  sdOverlayPut32(buf, val);
+  sdOverlayPut32(buf + 4, val >> 32);
+}
+
+static uint64_t sdOverlayGet64(const uint8_t* buf)
+{
+  return sdOverlayGet32(buf) | ((uint64_t)sdOverlayGet32(buf + 4) << 32);
+}
+
+static bool sdOverlayIo(SDL_IOStream* io, const char* file, uint64_t offset,
+    void* data, size_t size, bool write)
+{
+  if (SDL_SeekIO(io, offset, SDL_IO_SEEK_SET) < 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: failed to seek %" SDL_PRIu64, file, offset);
+    return false;
+  }
+
+  size_t done = write ? SDL_WriteIO(io, data, size)
+                      : SDL_ReadIO(io, data, size);
+  if (done != size) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: failed to %s %zu bytes at %" SDL_PRIu64, file,
+        write ? "write" : "read", size, offset);
+    return false;
+  }
+
+  return true;
+}
+
+static bool sdOverlayHas(emulator_sdoverlay_t* ov, uint64_t sector)
+{
+  return ov->meta[sector >> 3] & (1 << (sector & 7));
+}
+
+static uint32_t sdOverlaySlot(emulator_sdoverlay_t* ov, uint64_t cluster)
+{
+  return sdOverlayGet32(&ov->meta[ov->bitmapBytes + (cluster * 4)]);
+}
+
+static void sdOverlayMetaDirty(emulator_sdoverlay_t* ov, size_t offset)
+{
+  ov->metaDirty[offset / SD_IMAGE_SECTOR] = true;
+}
+
+// where a sector's slot keeps it in the delta, slots count from 1
+static uint64_t sdOverlaySlotPos(emulator_sdoverlay_t* ov, uint64_t sector)
+{
+  uint32_t slot = sdOverlaySlot(ov, sector / OVERLAY_CLUSTER);
+
+  return OVERLAY_HEADER + ov->metaBytes
+      + ((uint64_t)(slot - 1) * OVERLAY_CLUSTER_BYTES)
+      + ((sector % OVERLAY_CLUSTER) * SD_IMAGE_SECTOR);
+}
+
+// where a sector currently lives
+static uint64_t sdOverlayPos(emulator_sdoverlay_t* ov, uint64_t sector,
+    bool* inDelta)
+{
+  *inDelta = sdOverlayHas(ov, sector);
+  if (!*inDelta) {
+    return sector * SD_IMAGE_SECTOR;
+  }
+
+  return sdOverlaySlotPos(ov, sector);
+}
+
+static bool sdOverlayWriteHeader(emulator_sdoverlay_t* ov)
+{
+  uint8_t header[OVERLAY_HEADER] = { 0 };
+
+  SDL_memcpy(header, OVERLAY_MAGIC, 8);
+  sdOverlayPut32(&header[8], OVERLAY_VERSION);
+  sdOverlayPut32(&header[12], OVERLAY_CLUSTER);
+  sdOverlayPut64(&header[16], ov->sectors);
+  sdOverlayPut32(&header[24], ov->slots);
+
+  ov->headerDirty = false;
+
+  return sdOverlayIo(ov->delta, ov->deltaFile, 0, header, sizeof(header),
+      true);
+}
+
+// start an empty delta, truncating any old one
+static bool sdOverlayCreate(emulator_sdoverlay_t* ov)
+{
+  if (ov->delta) {
+    SDL_CloseIO(ov->delta);
+  }
+
+  ov->delta = SDL_IOFromFile(ov->deltaFile, "w+b");
+  if (!ov->delta) {
+    return false;
+  }
+
+  ov->slots = 0;
+  SDL_memset(ov->meta, 0, ov->metaBytes);
+  SDL_memset(ov->metaDirty, 0, ov->metaBytes / SD_IMAGE_SECTOR);
+
+  return sdOverlayWriteHeader(ov)
+      && sdOverlayIo(ov->delta, ov->deltaFile, OVERLAY_HEADER, ov->meta,
+          ov->metaBytes, true)
+      && SDL_FlushIO(ov->delta);
+}
+
+static bool sdOverlayLoad(emulator_sdoverlay_t* ov)
+{
+  uint8_t header[OVERLAY_HEADER];
+
+  if (!sdOverlayIo(ov->delta, ov->deltaFile, 0, header, sizeof(header),
+          false)) {
+    return false;
+  }
+
+  if ((SDL_memcmp(header, OVERLAY_MAGIC, 8) != 0)
+      || (sdOverlayGet32(&header[8]) != OVERLAY_VERSION)
+      || (sdOverlayGet32(&header[12]) != OVERLAY_CLUSTER)) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: not an SD overlay", ov->deltaFile);
+    return false;
+  }
+
+  if (sdOverlayGet64(&header[16]) != ov->sectors) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: made for a different size of base than %s", ov->deltaFile,
+        ov->baseFile);
+    return false;
+  }
+
+  ov->slots = sdOverlayGet32(&header[24]);
+  if (!sdOverlayIo(ov->delta, ov->deltaFile, OVERLAY_HEADER, ov->meta,
+          ov->metaBytes, false)) {
+    return false;
+  }
+
+  // trimmed clusters give up their slot so slots may outnumber clusters
+  for (uint64_t cluster = 0; cluster < ov->clusters; cluster++) {
+    if (sdOverlaySlot(ov, cluster) > ov->slots) {
+      SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s: bad cluster index",
+          ov->deltaFile);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+emulator_sdoverlay_t* sdOverlayOpen(const char* base, const char* delta)
+{
+  emulator_sdoverlay_t* ov = SDL_calloc(1, sizeof(*ov));
+  if (!ov) {
+    return NULL;
+  }
+
+  ov->baseFile = SDL_strdup(base);
+  ov->deltaFile = SDL_strdup(delta);
+  ov->base = SDL_IOFromFile(base, "rb");
+  if (!ov->baseFile || !ov->deltaFile || !ov->base) {
+    sdOverlayClose(ov);
+    return NULL;
+  }
+
+  ov->sectors = SDL_max(SDL_GetIOSize(ov->base), 0) / SD_IMAGE_SECTOR;
+  ov->clusters = (ov->sectors + OVERLAY_CLUSTER - 1) / OVERLAY_CLUSTER;
+  ov->bitmapBytes = OVERLAY_ROUND((ov->sectors + 7) / 8);
+  ov->metaBytes = ov->bitmapBytes + OVERLAY_ROUND(ov->clusters * 4);
+  ov->meta = SDL_malloc(ov->metaBytes);
+  ov->metaDirty = SDL_calloc(ov->metaBytes / SD_IMAGE_SECTOR, sizeof(bool));
+  if (!ov->meta || !ov->metaDirty) {
+    sdOverlayClose(ov);
+    return NULL;
+  }
+
+  ov->delta = SDL_IOFromFile(delta, "r+b");
+  if (ov->delta ? !sdOverlayLoad(ov) : !sdOverlayCreate(ov)) {
+    sdOverlayClose(ov);
+    return NULL;
+  }
+
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+      "%s: overlay on %s holding %" SDL_PRIu32 " clusters", delta, base,
+      ov->slots);
+
+  return ov;
+}
+
+void sdOverlayClose(emulator_sdoverlay_t* ov)
+{
+  if (!ov) {
+    return;
+  }
+
+  if (ov->delta) {
+    sdOverlayFlush(ov);
+    SDL_CloseIO(ov->delta);
+  }
+  if (ov->base) {
+    SDL_CloseIO(ov->base);
+  }
+
+  SDL_free(ov->metaDirty);
+  SDL_free(ov->meta);
+  SDL_free(ov->deltaFile);
+  SDL_free(ov->baseFile);
+  SDL_free(ov);
+}
+
+uint64_t sdOverlaySectors(emulator_sdoverlay_t* ov)
+{
+  return ov->sectors;
+}
+
+bool sdOverlayRead(emulator_sdoverlay_t* ov, uint64_t sector, void* data,
+    size_t count)
+{
+  uint8_t* dst = data;
+
+  if ((sector + count) > ov->sectors) {
+    return false;
+  }
+
+  // one host read per run that is contiguous in the same file
+  while (count) {
+    bool inDelta;
+    uint64_t pos = sdOverlayPos(ov, sector, &inDelta);
+    size_t n = 1;
+
+    while (n < count) {
+      bool nextInDelta;
+      uint64_t next = sdOverlayPos(ov, sector + n, &nextInDelta);
+
+      if ((nextInDelta != inDelta)
+          || (next != (pos + (n * SD_IMAGE_SECTOR)))) {
+        break;
+      }
+      n++;
+    }
+
+    if (!sdOverlayIo(inDelta ? ov->delta : ov->base,
+            inDelta ? ov->deltaFile : ov->baseFile, pos, dst,
+            n * SD_IMAGE_SECTOR, false)) {
+      return false;
+    }
+
+    dst += n * SD_IMAGE_SECTOR;
+    sector += n;
+    count -= n;
+  }
+
+  return true;
+}
+
+bool sdOverlayWrite(emulator_sdoverlay_t* ov, uint64_t sector,
+    const void* data, size_t count)
+{
+  const uint8_t* src = data;
+
+  if ((sector + count) > ov->sectors) {
+    return false;
+  }
+
+  while (count) {
+    uint64_t cluster = sector / OVERLAY_CLUSTER;
+    size_t n = SDL_min(count, OVERLAY_CLUSTER - (sector % OVERLAY_CLUSTER));
+
+    if (!sdOverlaySlot(ov, cluster)) {
+      size_t entry = ov->bitmapBytes + (cluster * 4);
+
+      sdOverlayPut32(&ov->meta[entry], ++ov->slots);
+      sdOverlayMetaDirty(ov, entry);
+      ov->headerDirty = true;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      ov->meta[(sector + i) >> 3] |= 1 << ((sector + i) & 7);
+      sdOverlayMetaDirty(ov, (sector + i) >> 3);
+    }
+
+    if (!sdOverlayIo(ov->delta, ov->deltaFile, sdOverlaySlotPos(ov, sector),
+            (void*)src, n * SD_IMAGE_SECTOR, true)) {
+      return false;
+    }
+
+    src += n * SD_IMAGE_SECTOR;
+    sector += n;
+    count -= n;
+  }
+
+  return true;
+}
+
+bool sdOverlayTrim(emulator_sdoverlay_t* ov, uint64_t sector, size_t count)
+{
+  if ((sector + count) > ov->sectors) {
+    return false;
+  }
+
+  // the punched ranges must not come back from the stream's buffer
+  SDL_FlushIO(ov->delta);
+
+  while (count) {
+    uint64_t cluster = sector / OVERLAY_CLUSTER;
+    size_t n = SDL_min(count, OVERLAY_CLUSTER - (sector % OVERLAY_CLUSTER));
+
+    if (sdOverlaySlot(ov, cluster)) {
+      uint64_t pos = sdOverlaySlotPos(ov, sector);
+      bool empty = true;
+
+      for (size_t i = 0; i < n; i++) {
+        ov->meta[(sector + i) >> 3] &= ~(1 << ((sector + i) & 7));
+        sdOverlayMetaDirty(ov, (sector + i) >> 3);
+      }
+
+      uint64_t first = cluster * OVERLAY_CLUSTER;
+      for (uint64_t s = first; s < SDL_min(first + OVERLAY_CLUSTER, ov->sectors);
+          s++) {
+        if (sdOverlayHas(ov, s)) {
+          empty = false;
+          break;
+        }
+      }
+
+      if (empty) {
+        size_t entry = ov->bitmapBytes + (cluster * 4);
+
+        sdOverlayPut32(&ov->meta[entry], 0);
+        sdOverlayMetaDirty(ov, entry);
+      }
+
+      sdImagePunchHole(ov->deltaFile, pos, n * SD_IMAGE_SECTOR);
+    }
+
+    sector += n;
+    count -= n;
+  }
+
+  return true;
+}
+
+bool sdOverlayFlush(emulator_sdoverlay_t* ov)
+{
+  size_t metaSectors = ov->metaBytes / SD_IMAGE_SECTOR;
+
+  if (ov->headerDirty && !sdOverlayWriteHeader(ov)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < metaSectors;) {
+    if (!ov->metaDirty[i]) {
+      i++;
+      continue;
+    }
+
+    size_t n = 1;
+    while (((i + n) < metaSectors) && ov->metaDirty[i + n]) {
+      n++;
+    }
+
+    size_t offset = i * SD_IMAGE_SECTOR;
+    if (!sdOverlayIo(ov->delta, ov->deltaFile, OVERLAY_HEADER + offset,
+            &ov->meta[offset], n * SD_IMAGE_SECTOR, true)) {
+      return false;
+    }
+
+    SDL_memset(&ov->metaDirty[i], 0, n * sizeof(bool));
+    i += n;
+  }
+
+  return SDL_FlushIO(ov->delta);
+}
+
+bool sdOverlayCommit(emulator_sdoverlay_t* ov)
+{
+  SDL_IOStream* base = SDL_IOFromFile(ov->baseFile, "r+b");
+  bool ok = true;
+
+  if (!base) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: cannot open for writing: %s", ov->baseFile, SDL_GetError());
+    return false;
+  }
+
+  for (uint64_t cluster = 0; ok && (cluster < ov->clusters); cluster++) {
+    if (!sdOverlaySlot(ov, cluster)) {
+      continue;
+    }
+
+    uint64_t first = cluster * OVERLAY_CLUSTER;
+    uint64_t end = SDL_min(first + OVERLAY_CLUSTER, ov->sectors);
+    for (uint64_t sector = first; ok && (sector < end);) {
+      if (!sdOverlayHas(ov, sector)) {
+        sector++;
+        continue;
+      }
+
+      size_t n = 1;
+      while (((sector + n) < end) && sdOverlayHas(ov, sector + n)) {
+        n++;
+      }
+
+      ok = sdOverlayRead(ov, sector, ov->run, n)
+          && sdOverlayIo(base, ov->baseFile, sector * SD_IMAGE_SECTOR,
+              ov->run, n * SD_IMAGE_SECTOR, true);
+      sector += n;
+    }
+  }
+
+  ok = SDL_FlushIO(base) && ok;
+  SDL_CloseIO(base);
+
+  if (!ok) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "%s: commit failed, keeping the overlay", ov->deltaFile);
+    return false;
+  }
+
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "%s: committed to %s",
+      ov->deltaFile, ov->baseFile);
+
+  return sdOverlayDiscard(ov);
+}
+
+bool sdOverlayDiscard(emulator_sdoverlay_t* ov)
+{
+  if (!sdOverlayCreate(ov)) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s: failed to empty: %s",
+        ov->deltaFile, SDL_GetError());
+    return false;
+  }
+
+  return true;
+}
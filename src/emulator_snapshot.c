@@ -0,0 +1,1168 @@
+/*
+ * Copyright (c) 2026 Graeme Gregory
+ *
+ * SPDX: GPL-2.0-only
+ */
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "emulator_memory.h"
+#include "emulator_options.h"
+#include "emulator_screen.h"
+#include "emulator_sdimage.h"
+#include "emulator_snapshot.h"
+#include "emulator_trace.h"
+#include "m68k.h"
+
+/*
+ * Machine snapshots. The file is a fixed header followed by tagged
+ * chunks written straight to the stream, the length of each chunk is
+ * patched in once it is complete. Memory regions are stored as 4K pages
+ * where all zero pages cost a single byte and other pages are LZ
+ * compressed when that makes them smaller, so a mostly empty 28MB Q68
+ * snapshots to a small file in a few milliseconds.
+ */
+
+#define EMU_SNAP_MAGIC "sQ68Lay\x1a"
+#define EMU_SNAP_VERSION 1
+
+#define EMU_SNAP_PAGE_SIZE 4096
+
+enum {
+  EMU_SNAP_PAGE_ZERO,
+  EMU_SNAP_PAGE_RAW,
+  EMU_SNAP_PAGE_LZ,
+};
+
+typedef struct {
+  uint32_t tag;
+  uint32_t size;
+  Sint64 offset;
+} emulator_snapshot_chunk_t;
+
+struct emulator_snapshot {
+  SDL_IOStream* io;
+  bool failed;
+  bool compress;
+
+  // writing, where the open chunk's length goes
+  Sint64 chunkLength;
+
+  // reading, index of the chunks in the file
+  emulator_snapshot_chunk_t* chunks;
+  int chunkCount;
+  uint32_t remaining;
+
+  // decoded RAM, copied into place with the rest of the machine
+  uint8_t* ram;
+
+  uint8_t packed[EMU_SNAP_PAGE_SIZE];
+};
+
+static const uint8_t zeroPage[EMU_SNAP_PAGE_SIZE];
+
+/*
+ * LZ77 in the style of an LZ4 block. A token byte holds the literal
+ * count and match length in its nibbles, 15 in either means extra
+ * length bytes follow. Literals come next then a 16 bit offset, the
+ * final sequence is literals only.
+ */
+#define EMU_LZ_HASH_BITS 12
+#define EMU_LZ_MIN_MATCH 4
+
+static uint32_t lzRead32(const uint8_t* ptr)
+{
+  uint32_t val;
+
+  SDL_memcpy(&val, ptr, sizeof(val));
+  return val;
+}
+
+static size_t lzPutLength(uint8_t* dst, size_t op, size_t cap, size_t len)
+{
+  while (len >= 255) {
+    if (op >= cap) {
+      return SIZE_MAX;
+    }
+    dst[op++] = 255;
+    len -= 255;
+  }
+
+  if (op >= cap) {
+    return SIZE_MAX;
+  }
+  dst[op++] = len;
+
+  return op;
+}
+
+static size_t lzPutSequence(uint8_t* dst, size_t op, size_t cap,
+    const uint8_t* lit, size_t litLen, size_t offset, size_t matchLen)
+{
+  size_t matchCode = matchLen ? matchLen - EMU_LZ_MIN_MATCH : 0;
+
+  if (op >= cap) {
+    return SIZE_MAX;
+  }
+  dst[op++] = (SDL_min(litLen, 15) << 4) | SDL_min(matchCode, 15);
+
+  if (litLen >= 15) {
+    op = lzPutLength(dst, op, cap, litLen - 15);
+    if (op == SIZE_MAX) {
+      return op;
+    }
+  }
+
+  if ((op + litLen) > cap) {
+    return SIZE_MAX;
+  }
+  SDL_memcpy(&dst[op], lit, litLen);
+  op += litLen;
+
+  // the last sequence has no match
+  if (!matchLen) {
+    return op;
+  }
+
+  if ((op + 2) > cap) {
+    return SIZE_MAX;
+  }
+  dst[op++] = offset & 0xFF;
+  dst[op++] = offset >> 8;
+
+  if (matchCode >= 15) {
+    op = lzPutLength(dst, op, cap, matchCode - 15);
+  }
+
+  return op;
+}
+
+// returns the packed size, or 0 if it would not fit in cap bytes
+static size_t lzCompress(const uint8_t* src, size_t len, uint8_t* dst,
+    size_t cap)
+{
+  uint16_t table[1 << EMU_LZ_HASH_BITS];
+  size_t ip = 0;
+  size_t anchor = 0;
+  size_t op = 0;
+
+  SDL_memset(table, 0, sizeof(table));
+
+  while ((ip + EMU_LZ_MIN_MATCH) <= len) {
+    uint32_t seq = lzRead32(&src[ip]);
+    uint32_t hash = (seq * 2654435761U) >> (32 - EMU_LZ_HASH_BITS);
+    size_t ref = table[hash];
+
+    table[hash] = ip;
+
+    if ((ref >= ip) || (lzRead32(&src[ref]) != seq)) {
+      ip++;
+      continue;
+    }
+
+    size_t matchLen = EMU_LZ_MIN_MATCH;
+    while (((ip + matchLen) < len) && (src[ref + matchLen] == src[ip + matchLen])) {
+      matchLen++;
+    }
+
+    op = lzPutSequence(dst, op, cap, &src[anchor], ip - anchor, ip - ref,
+        matchLen);
+    if (op == SIZE_MAX) {
+      return 0;
+    }
+
+    ip += matchLen;
+    anchor = ip;
+  }
+
+  op = lzPutSequence(dst, op, cap, &src[anchor], len - anchor, 0, 0);
+  if (op == SIZE_MAX) {
+    return 0;
+  }
+
+  return op;
+}
+
+static bool lzGetLength(const uint8_t* src, size_t len, size_t* ip,
+    size_t* val)
+{
+  uint8_t byte;
+
+  do {
+    if (*ip >= len) {
+      return false;
+    }
+    byte = src[(*ip)++];
+    *val += byte;
+  } while (byte == 255);
+
+  return true;
+}
+
+static bool lzDecompress(const uint8_t* src, size_t len, uint8_t* dst,
+    size_t size)
+{
+  size_t ip = 0;
+  size_t op = 0;
+
+  while (ip < len) {
+    uint8_t token = src[ip++];
+    size_t litLen = token >> 4;
+    size_t matchLen = token & 0xF;
+
+    if ((litLen == 15) && !lzGetLength(src, len, &ip, &litLen)) {
+      return false;
+    }
+
+    if (((ip + litLen) > len) || ((op + litLen) > size)) {
+      return false;
+    }
+    SDL_memcpy(&dst[op], &src[ip], litLen);
+    ip += litLen;
+    op += litLen;
+
+    if (ip == len) {
+      break;
+    }
+
+    if ((ip + 2) > len) {
+      return false;
+    }
+    size_t offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+
+    if ((matchLen == 15) && !lzGetLength(src, len, &ip, &matchLen)) {
+      return false;
+    }
+    matchLen += EMU_LZ_MIN_MATCH;
+
+    if ((offset == 0) || (offset > op) || ((op + matchLen) > size)) {
+      return false;
+    }
+
+    // byte at a time as the match may overlap itself
+    for (size_t i = 0; i < matchLen; i++, op++) {
+      dst[op] = dst[op - offset];
+    }
+  }
+
+  return op == size;
+}
+
+void emulatorSnapshotFail(emulator_snapshot_t* snap, const char* what)
+{
+  if (!snap->failed) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Snapshot: %s", what);
+  }
+  snap->failed = true;
+}
+
+bool emulatorSnapshotFailed(emulator_snapshot_t* snap)
+{
+  return snap->failed;
+}
+
+void emulatorSnapshotPutBytes(emulator_snapshot_t* snap, const void* data,
+    size_t size)
+{
+  if (snap->failed || !size) {
+    return;
+  }
+
+  if (SDL_WriteIO(snap->io, data, size) != size) {
+    emulatorSnapshotFail(snap, SDL_GetError());
+  }
+}
+
+void emulatorSnapshotPut8(emulator_snapshot_t* snap, uint8_t val)
+{
+  emulatorSnapshotPutBytes(snap, &val, sizeof(val));
+}
+
+void emulatorSnapshotPut16(emulator_snapshot_t* snap, uint16_t val)
+{
+  val = SDL_Swap16LE(val);
+  emulatorSnapshotPutBytes(snap, &val, sizeof(val));
+}
+
+void emulatorSnapshotPut32(emulator_snapshot_t* snap, uint32_t val)
+{
+  val = SDL_Swap32LE(val);
+  emulatorSnapshotPutBytes(snap, &val, sizeof(val));
+}
+
+void emulatorSnapshotPut64(emulator_snapshot_t* snap, uint64_t val)
+{
+  val = SDL_Swap64LE(val);
+  emulatorSnapshotPutBytes(snap, &val, sizeof(val));
+}
+
+void emulatorSnapshotBegin(emulator_snapshot_t* snap, uint32_t tag)
+{
+  emulatorSnapshotPut32(snap, tag);
+  snap->chunkLength = SDL_TellIO(snap->io);
+  emulatorSnapshotPut32(snap, 0);
+}
+
+void emulatorSnapshotEnd(emulator_snapshot_t* snap)
+{
+  if (snap->failed) {
+    return;
+  }
+
+  Sint64 end = SDL_TellIO(snap->io);
+  Sint64 size = end - snap->chunkLength - 4;
+
+  if ((size < 0) || (size > UINT32_MAX)) {
+    emulatorSnapshotFail(snap, "chunk too large");
+    return;
+  }
+
+  SDL_SeekIO(snap->io, snap->chunkLength, SDL_IO_SEEK_SET);
+  emulatorSnapshotPut32(snap, size);
+  SDL_SeekIO(snap->io, end, SDL_IO_SEEK_SET);
+}
+
+void emulatorSnapshotPutRegion(emulator_snapshot_t* snap,
+    const uint8_t* mem, size_t size)
+{
+  emulatorSnapshotPut32(snap, size);
+
+  for (size_t offset = 0; offset < size; offset += EMU_SNAP_PAGE_SIZE) {
+    size_t len = SDL_min(size - offset, EMU_SNAP_PAGE_SIZE);
+    const uint8_t* page = &mem[offset];
+
+    if (SDL_memcmp(page, zeroPage, len) == 0) {
+      emulatorSnapshotPut8(snap, EMU_SNAP_PAGE_ZERO);
+      continue;
+    }
+
+    size_t packed = 0;
+    if (snap->compress) {
+      packed = lzCompress(page, len, snap->packed, len - 1);
+    }
+
+    if (packed) {
+      emulatorSnapshotPut8(snap, EMU_SNAP_PAGE_LZ);
+      emulatorSnapshotPut16(snap, packed);
+      emulatorSnapshotPutBytes(snap, snap->packed, packed);
+    } else {
+      emulatorSnapshotPut8(snap, EMU_SNAP_PAGE_RAW);
+      emulatorSnapshotPutBytes(snap, page, len);
+    }
+  }
+}
+
+static bool emulatorSnapshotSeek(emulator_snapshot_t* snap, uint32_t tag)
+{
+  if (snap->failed) {
+    return false;
+  }
+
+  for (int i = 0; i < snap->chunkCount; i++) {
+    if (snap->chunks[i].tag != tag) {
+      continue;
+    }
+
+    SDL_SeekIO(snap->io, snap->chunks[i].offset, SDL_IO_SEEK_SET);
+    snap->remaining = snap->chunks[i].size;
+    return true;
+  }
+
+  return false;
+}
+
+bool emulatorSnapshotFind(emulator_snapshot_t* snap, uint32_t tag)
+{
+  if (snap->failed) {
+    return false;
+  }
+
+  if (emulatorSnapshotSeek(snap, tag)) {
+    return true;
+  }
+
+  char what[32];
+  SDL_snprintf(what, sizeof(what), "missing chunk %c%c%c%c",
+      tag & 0xFF, (tag >> 8) & 0xFF, (tag >> 16) & 0xFF, tag >> 24);
+  emulatorSnapshotFail(snap, what);
+
+  return false;
+}
+
+void emulatorSnapshotGetBytes(emulator_snapshot_t* snap, void* data,
+    size_t size)
+{
+  if (!snap->failed && (size > snap->remaining)) {
+    emulatorSnapshotFail(snap, "chunk too short");
+  }
+
+  if (!snap->failed && (SDL_ReadIO(snap->io, data, size) != size)) {
+    emulatorSnapshotFail(snap, "read failed");
+  }
+
+  if (snap->failed) {
+    SDL_memset(data, 0, size);
+    return;
+  }
+
+  snap->remaining -= size;
+}
+
+uint8_t emulatorSnapshotGet8(emulator_snapshot_t* snap)
+{
+  uint8_t val;
+
+  emulatorSnapshotGetBytes(snap, &val, sizeof(val));
+  return val;
+}
+
+uint16_t emulatorSnapshotGet16(emulator_snapshot_t* snap)
+{
+  uint16_t val;
+
+  emulatorSnapshotGetBytes(snap, &val, sizeof(val));
+  return SDL_Swap16LE(val);
+}
+
+uint32_t emulatorSnapshotGet32(emulator_snapshot_t* snap)
+{
+  uint32_t val;
+
+  emulatorSnapshotGetBytes(snap, &val, sizeof(val));
+  return SDL_Swap32LE(val);
+}
+
+uint64_t emulatorSnapshotGet64(emulator_snapshot_t* snap)
+{
+  uint64_t val;
+
+  emulatorSnapshotGetBytes(snap, &val, sizeof(val));
+  return SDL_Swap64LE(val);
+}
+
+void emulatorSnapshotGetRegion(emulator_snapshot_t* snap, uint8_t* mem,
+    size_t size)
+{
+  if (emulatorSnapshotGet32(snap) != size) {
+    emulatorSnapshotFail(snap, "region size mismatch");
+    return;
+  }
+
+  for (size_t offset = 0; offset < size; offset += EMU_SNAP_PAGE_SIZE) {
+    size_t len = SDL_min(size - offset, EMU_SNAP_PAGE_SIZE);
+    uint8_t* page = &mem[offset];
+
+    switch (emulatorSnapshotGet8(snap)) {
+    case EMU_SNAP_PAGE_ZERO:
+      SDL_memset(page, 0, len);
+      break;
+    case EMU_SNAP_PAGE_RAW:
+      emulatorSnapshotGetBytes(snap, page, len);
+      break;
+    case EMU_SNAP_PAGE_LZ: {
+      size_t packed = emulatorSnapshotGet16(snap);
+
+      if (packed > sizeof(snap->packed)) {
+        emulatorSnapshotFail(snap, "bad page");
+        break;
+      }
+
+      emulatorSnapshotGetBytes(snap, snap->packed, packed);
+      if (!snap->failed && !lzDecompress(snap->packed, packed, page, len)) {
+        emulatorSnapshotFail(snap, "corrupt page");
+      }
+      break;
+    }
+    default:
+      emulatorSnapshotFail(snap, "bad page");
+      break;
+    }
+
+    if (snap->failed) {
+      return;
+    }
+  }
+}
+
+/*
+ * The registers are stored rather than Musashi's context, that holds
+ * host pointers which are not valid in another process. SR goes first
+ * so the stack pointers land in the right banks.
+ */
+static const int snapshotCpuRegs[] = {
+  M68K_REG_SR,
+  M68K_REG_USP,
+  M68K_REG_ISP,
+  M68K_REG_MSP,
+  M68K_REG_D0,
+  M68K_REG_D1,
+  M68K_REG_D2,
+  M68K_REG_D3,
+  M68K_REG_D4,
+  M68K_REG_D5,
+  M68K_REG_D6,
+  M68K_REG_D7,
+  M68K_REG_A0,
+  M68K_REG_A1,
+  M68K_REG_A2,
+  M68K_REG_A3,
+  M68K_REG_A4,
+  M68K_REG_A5,
+  M68K_REG_A6,
+  M68K_REG_A7,
+  M68K_REG_PC,
+  M68K_REG_PPC,
+  M68K_REG_IR,
+  M68K_REG_VBR,
+  M68K_REG_SFC,
+  M68K_REG_DFC,
+  M68K_REG_CACR,
+  M68K_REG_CAAR,
+};
+
+#define EMU_SNAP_CPU_REGS (sizeof(snapshotCpuRegs) / sizeof(snapshotCpuRegs[0]))
+
+void emulatorSnapshotSaveCpu(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_CPU);
+  emulatorSnapshotPut32(snap, EMU_SNAP_CPU_REGS);
+  for (size_t i = 0; i < EMU_SNAP_CPU_REGS; i++) {
+    emulatorSnapshotPut32(snap, m68k_get_reg(NULL, snapshotCpuRegs[i]));
+  }
+  emulatorSnapshotEnd(snap);
+}
+
+void emulatorSnapshotLoadCpu(emulator_snapshot_t* snap)
+{
+  uint32_t regs[EMU_SNAP_CPU_REGS];
+
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_CPU)) {
+    return;
+  }
+
+  if (emulatorSnapshotGet32(snap) != EMU_SNAP_CPU_REGS) {
+    emulatorSnapshotFail(snap, "bad cpu chunk");
+    return;
+  }
+
+  for (size_t i = 0; i < EMU_SNAP_CPU_REGS; i++) {
+    regs[i] = emulatorSnapshotGet32(snap);
+  }
+
+  if (snap->failed) {
+    return;
+  }
+
+  // leave any STOP state and drop the prefetched opcodes
+  m68k_pulse_reset();
+
+  for (size_t i = 0; i < EMU_SNAP_CPU_REGS; i++) {
+    m68k_set_reg(snapshotCpuRegs[i], regs[i]);
+  }
+  m68k_set_reg(M68K_REG_PREF_ADDR, ~m68k_get_reg(NULL, M68K_REG_PC));
+}
+
+static bool emulatorSnapshotIndex(emulator_snapshot_t* snap)
+{
+  Sint64 size = SDL_GetIOSize(snap->io);
+  Sint64 offset = SDL_TellIO(snap->io);
+
+  while (offset < size) {
+    uint32_t header[2];
+
+    if ((size - offset) < (Sint64)sizeof(header)
+        || SDL_ReadIO(snap->io, header, sizeof(header)) != sizeof(header)) {
+      return false;
+    }
+
+    offset += sizeof(header);
+
+    emulator_snapshot_chunk_t chunk = {
+      .tag = SDL_Swap32LE(header[0]),
+      .size = SDL_Swap32LE(header[1]),
+      .offset = offset,
+    };
+
+    if ((size - offset) < chunk.size) {
+      return false;
+    }
+
+    emulator_snapshot_chunk_t* chunks = SDL_realloc(snap->chunks,
+        (snap->chunkCount + 1) * sizeof(*chunks));
+    if (!chunks) {
+      return false;
+    }
+    snap->chunks = chunks;
+    snap->chunks[snap->chunkCount++] = chunk;
+
+    offset += chunk.size;
+    SDL_SeekIO(snap->io, offset, SDL_IO_SEEK_SET);
+  }
+
+  return true;
+}
+
+const char* emulatorSnapshotFile(void)
+{
+  const char* file = emulatorOptionString("snapshot");
+
+  if (!file || !SDL_strlen(file)) {
+    return EMU_STR ".snap";
+  }
+
+  return file;
+}
+
+static emulator_snapshot_t* emulatorSnapshotNew(SDL_IOStream* io)
+{
+  emulator_snapshot_t* snap = SDL_calloc(1, sizeof(emulator_snapshot_t));
+  if (!snap) {
+    SDL_CloseIO(io);
+    return NULL;
+  }
+
+  snap->io = io;
+
+  return snap;
+}
+
+static emulator_snapshot_t* emulatorSnapshotOpen(const char* file,
+    const char* mode)
+{
+  SDL_IOStream* io = SDL_IOFromFile(file, mode);
+  if (!io) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Snapshot %s: %s", file,
+        SDL_GetError());
+    return NULL;
+  }
+
+  emulator_snapshot_t* snap = emulatorSnapshotNew(io);
+  if (!snap) {
+    return NULL;
+  }
+
+  snap->compress = emulatorOptionInt("snapshot-compress");
+
+  return snap;
+}
+
+static bool emulatorSnapshotClose(emulator_snapshot_t* snap)
+{
+  bool ok = !snap->failed;
+
+  if (!SDL_CloseIO(snap->io)) {
+    ok = false;
+  }
+
+  SDL_free(snap->chunks);
+  SDL_free(snap->ram);
+  SDL_free(snap);
+
+  return ok;
+}
+
+static void emulatorSnapshotPutAll(emulator_snapshot_t* snap,
+    const uint64_t* key, bool ram)
+{
+  emulatorSnapshotPutBytes(snap, EMU_SNAP_MAGIC, 8);
+  emulatorSnapshotPut32(snap, EMU_SNAP_VERSION);
+
+  emulatorSnapshotBegin(snap, EMU_SNAP_MACHINE);
+  emulatorSnapshotPutBytes(snap, EMU_STR, sizeof(EMU_STR));
+  emulatorSnapshotPut32(snap, emulatorMemorySize());
+  emulatorSnapshotEnd(snap);
+
+  if (key) {
+    emulatorSnapshotBegin(snap, EMU_SNAP_BOOT);
+    emulatorSnapshotPut64(snap, *key);
+    emulatorSnapshotEnd(snap);
+  }
+
+  emulatorSnapshotSaveCpu(snap);
+
+  if (ram) {
+    emulatorSnapshotBegin(snap, EMU_SNAP_RAM);
+    emulatorSnapshotPutRegion(snap, emulatorMemorySpace(),
+        emulatorMemorySize());
+    emulatorSnapshotEnd(snap);
+  }
+
+  emulatorSnapshotBegin(snap, EMU_SNAP_DISPLAY);
+  emulatorSnapshotPut8(snap, emulatorCurrentMode);
+  emulatorSnapshotPut8(snap, emulatorSecondScreen);
+  emulatorSnapshotEnd(snap);
+
+  emulatorMachineSave(snap);
+}
+
+static bool emulatorSnapshotWrite(const char* file, const uint64_t* key)
+{
+  uint64_t start = SDL_GetTicksNS();
+
+  emulator_snapshot_t* snap = emulatorSnapshotOpen(file, "wb");
+  if (!snap) {
+    return false;
+  }
+
+  emulatorSnapshotPutAll(snap, key, true);
+
+  Sint64 size = SDL_TellIO(snap->io);
+  if (!emulatorSnapshotClose(snap)) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "Failed to save snapshot %s", file);
+    return false;
+  }
+
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+      "Saved snapshot %s, %" SDL_PRIs64 " bytes in %" SDL_PRIu64 "ms",
+      file, size, (SDL_GetTicksNS() - start) / SDL_NS_PER_MS);
+
+  return true;
+}
+
+bool emulatorSnapshotSave(const char* file)
+{
+  return emulatorSnapshotWrite(file, NULL);
+}
+
+// check the header and index the chunks of a snapshot open for reading
+static bool emulatorSnapshotCheck(emulator_snapshot_t* snap)
+{
+  char magic[8];
+  uint32_t version;
+  char machine[sizeof(EMU_STR)];
+
+  if ((SDL_ReadIO(snap->io, magic, sizeof(magic)) != sizeof(magic))
+      || SDL_memcmp(magic, EMU_SNAP_MAGIC, sizeof(magic)) != 0) {
+    emulatorSnapshotFail(snap, "not a snapshot");
+  } else if ((SDL_ReadIO(snap->io, &version, sizeof(version)) != sizeof(version))
+      || (SDL_Swap32LE(version) != EMU_SNAP_VERSION)) {
+    emulatorSnapshotFail(snap, "unsupported version");
+  } else if (!emulatorSnapshotIndex(snap)) {
+    emulatorSnapshotFail(snap, "truncated");
+  }
+
+  if (emulatorSnapshotFind(snap, EMU_SNAP_MACHINE)) {
+    emulatorSnapshotGetBytes(snap, machine, sizeof(machine));
+    if (SDL_memcmp(machine, EMU_STR, sizeof(machine)) != 0) {
+      emulatorSnapshotFail(snap, "snapshot is for another machine");
+    } else if (emulatorSnapshotGet32(snap) != emulatorMemorySize()) {
+      emulatorSnapshotFail(snap, "snapshot has a different memory size");
+    }
+  }
+
+  return !snap->failed;
+}
+
+static emulator_snapshot_t* emulatorSnapshotOpenRead(const char* file)
+{
+  emulator_snapshot_t* snap = emulatorSnapshotOpen(file, "rb");
+  if (!snap) {
+    return NULL;
+  }
+
+  if (!emulatorSnapshotCheck(snap)) {
+    emulatorSnapshotClose(snap);
+    return NULL;
+  }
+
+  return snap;
+}
+
+// RAM is decoded to the side so a corrupt page leaves the machine alone
+static bool emulatorSnapshotDecodeRam(emulator_snapshot_t* snap)
+{
+  snap->ram = SDL_malloc(emulatorMemorySize());
+  if (!snap->ram) {
+    emulatorSnapshotFail(snap, "out of memory");
+  } else if (emulatorSnapshotFind(snap, EMU_SNAP_RAM)) {
+    emulatorSnapshotGetRegion(snap, snap->ram, emulatorMemorySize());
+  }
+
+  return !snap->failed;
+}
+
+/*
+ * The machine as it is now, kept in memory while a snapshot loads. The
+ * devices only find out whether their chunks make sense as they read
+ * them, so if one refuses this is loaded back over the partial restore.
+ */
+static emulator_snapshot_t* emulatorSnapshotUndo(void)
+{
+  SDL_IOStream* io = SDL_IOFromDynamicMem();
+  if (!io) {
+    return NULL;
+  }
+
+  emulator_snapshot_t* undo = emulatorSnapshotNew(io);
+  if (!undo) {
+    return NULL;
+  }
+
+  undo->ram = SDL_malloc(emulatorMemorySize());
+  if (!undo->ram) {
+    emulatorSnapshotFail(undo, "out of memory");
+  } else {
+    SDL_memcpy(undo->ram, emulatorMemorySpace(), emulatorMemorySize());
+    emulatorSnapshotPutAll(undo, NULL, false);
+  }
+
+  SDL_SeekIO(io, 0, SDL_IO_SEEK_SET);
+  if (undo->failed || !emulatorSnapshotCheck(undo)) {
+    emulatorSnapshotClose(undo);
+    return NULL;
+  }
+
+  return undo;
+}
+
+static void emulatorSnapshotRestore(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotLoadCpu(snap);
+
+  SDL_memcpy(emulatorMemorySpace(), snap->ram, emulatorMemorySize());
+
+  emulatorMachineLoad(snap);
+
+  if (emulatorSnapshotFind(snap, EMU_SNAP_DISPLAY)) {
+    emulatorScreenChangeMode(emulatorSnapshotGet8(snap) & 7);
+    emulatorSecondScreen = emulatorSnapshotGet8(snap);
+  }
+
+  emulatorMemoryMapUpdate();
+  emulatorScreenRedraw();
+}
+
+// takes over snap, which must have its RAM decoded
+static bool emulatorSnapshotApply(emulator_snapshot_t* snap,
+    const char* file)
+{
+  uint64_t start = SDL_GetTicksNS();
+
+  emulator_snapshot_t* undo = emulatorSnapshotUndo();
+  if (!undo) {
+    emulatorSnapshotClose(snap);
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "Failed to load snapshot %s, cannot save the running machine", file);
+    return false;
+  }
+
+  emulatorSnapshotRestore(snap);
+  bool ok = emulatorSnapshotClose(snap);
+
+  if (!ok) {
+    emulatorSnapshotRestore(undo);
+  }
+  emulatorSnapshotClose(undo);
+
+  if (!ok) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "Failed to load snapshot %s, machine left as it was", file);
+    return false;
+  }
+
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+      "Loaded snapshot %s in %" SDL_PRIu64 "ms", file,
+      (SDL_GetTicksNS() - start) / SDL_NS_PER_MS);
+
+  return true;
+}
+
+bool emulatorSnapshotLoad(const char* file)
+{
+  emulator_snapshot_t* snap = emulatorSnapshotOpenRead(file);
+  if (snap && !emulatorSnapshotDecodeRam(snap)) {
+    emulatorSnapshotClose(snap);
+    snap = NULL;
+  }
+
+  if (!snap) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "Failed to load snapshot %s", file);
+    return false;
+  }
+
+  return emulatorSnapshotApply(snap, file);
+}
+
+/*
+ * Boot snapshots. The first start with a given ROM, configuration and
+ * set of disk images runs until the guest reaches boot-snapshot-pc, or
+ * for boot-snapshot-frames frames, and saves a snapshot tagged with a
+ * hash of all three. Later starts with the same hash restore it over
+ * the freshly reset machine, a snapshot that will not restore is removed
+ * and the machine boots as normal. Files up to 1MB, ROMs and microdrive
+ * images, are hashed by contents. Larger files such as SD card images
+ * and overlay deltas go in by path, size and modification time, so a
+ * card written since the snapshot was taken no longer matches it. The
+ * key is worked out again when the snapshot is saved, after the SD card
+ * images have been written back.
+ */
+
+#define BOOT_HASH_OFFSET 0xcbf29ce484222325ULL
+#define BOOT_HASH_PRIME 0x100000001b3ULL
+#define BOOT_HASH_FILE_MAX (1024 * 1024)
+
+bool emulatorBootCapture = false;
+
+static const char* bootFile = NULL;
+static uint64_t bootKey = 0;
+static emulator_snapshot_t* bootSnap = NULL;
+static unsigned int bootPc = 0;
+static int bootFrames = 0;
+static bool bootDue = false;
+
+// options that make no difference to the guest
+static const char* const bootKeySkip[] = {
+  "ayvol",
+  "bench",
+  "boot-snapshot",
+  "boot-snapshot-frames",
+  "boot-snapshot-pc",
+  "cpu_hog",
+  "fast_startup",
+  "fastfps",
+  "idle-pc",
+  "ipcvol",
+  "mdv-flush",
+  "mdvvol",
+  "palette",
+  "qlsd-hle-cycles",
+  "sd-async",
+  "sd-cache",
+  "sd-mmap",
+  "sd-msync",
+  "sd-overlay-exit",
+  "snapshot",
+  "snapshot-compress",
+  "sssvol",
+  "trace",
+  "trace-high",
+  "trace-low",
+  "trace-map",
+  NULL,
+};
+
+static uint64_t bootHash(uint64_t hash, const void* data, size_t size)
+{
+  const uint8_t* bytes = data;
+
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= BOOT_HASH_PRIME;
+  }
+
+  return hash;
+}
+
+static uint64_t bootHashFile(uint64_t hash, const char* path)
+{
+  SDL_PathInfo info;
+
+  if (!SDL_strlen(path) || !SDL_GetPathInfo(path, &info)) {
+    return hash;
+  }
+
+  hash = bootHash(hash, path, SDL_strlen(path) + 1);
+  if (info.type != SDL_PATHTYPE_FILE) {
+    return hash;
+  }
+
+  uint64_t size = SDL_Swap64LE(info.size);
+  hash = bootHash(hash, &size, sizeof(size));
+
+  if (info.size > BOOT_HASH_FILE_MAX) {
+    uint64_t mtime = SDL_Swap64LE(info.modify_time);
+
+    hash = bootHash(hash, &mtime, sizeof(mtime));
+  } else {
+    size_t len;
+    void* data = SDL_LoadFile(path, &len);
+
+    if (data) {
+      hash = bootHash(hash, data, len);
+      SDL_free(data);
+    }
+  }
+
+  return hash;
+}
+
+// values may be a file, R:file or address@file as well as plain settings
+static void bootHashOption(const char* name, const char* value, void* user)
+{
+  uint64_t* hash = user;
+
+  for (int i = 0; bootKeySkip[i] != NULL; i++) {
+    if (SDL_strcmp(name, bootKeySkip[i]) == 0) {
+      return;
+    }
+  }
+
+  *hash = bootHash(*hash, name, SDL_strlen(name) + 1);
+  *hash = bootHash(*hash, value, SDL_strlen(value) + 1);
+
+  if (SDL_strncasecmp(value, "R:", 2) == 0) {
+    value += 2;
+  }
+  *hash = bootHashFile(*hash, value);
+
+  const char* at = SDL_strchr(value, '@');
+  if (at) {
+    char* before = SDL_strndup(value, at - value);
+
+    *hash = bootHashFile(*hash, before);
+    *hash = bootHashFile(*hash, at + 1);
+    SDL_free(before);
+  }
+}
+
+static void emulatorBootSnapshotArm(void)
+{
+  const char* pc = emulatorOptionString("boot-snapshot-pc");
+
+  if (SDL_strlen(pc)) {
+    char* end;
+    bootPc = SDL_strtoul(pc, &end, 0);
+
+    if ((*end != '\0') && !emulatorTraceLookup(pc, &bootPc)) {
+      SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+          "boot-snapshot-pc %s is not an address or trace-map symbol", pc);
+      return;
+    }
+
+    emulatorBootCapture = true;
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+        "Boot snapshot %s will be taken at PC %8.8x", bootFile, bootPc);
+    return;
+  }
+
+  bootFrames = emulatorOptionInt("boot-snapshot-frames");
+  if (bootFrames > 0) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+        "Boot snapshot %s will be taken after %d frames", bootFile,
+        bootFrames);
+  }
+}
+
+static uint64_t emulatorBootSnapshotKey(void)
+{
+  uint64_t key = bootHash(BOOT_HASH_OFFSET, EMU_STR, sizeof(EMU_STR));
+
+  emulatorOptionForEach(bootHashOption, &key);
+
+  return key;
+}
+
+// a broken boot snapshot is removed so this boot can take a new one
+static void emulatorBootSnapshotDiscard(void)
+{
+  SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+      "Boot snapshot %s is unusable, booting normally", bootFile);
+
+  if (!SDL_RemovePath(bootFile)) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to remove %s: %s",
+        bootFile, SDL_GetError());
+  }
+}
+
+void emulatorBootSnapshotInit(void)
+{
+  bootFile = emulatorOptionString("boot-snapshot");
+  if (!SDL_strlen(bootFile)) {
+    if (!emulatorOptionInt("fast_startup")) {
+      bootFile = NULL;
+      return;
+    }
+    bootFile = EMU_STR "-boot.snap";
+  }
+
+  bootKey = emulatorBootSnapshotKey();
+
+  if (SDL_GetPathInfo(bootFile, NULL)) {
+    bootSnap = emulatorSnapshotOpenRead(bootFile);
+    if (!bootSnap) {
+      emulatorBootSnapshotDiscard();
+    }
+  }
+
+  if (bootSnap) {
+    if (!emulatorSnapshotSeek(bootSnap, EMU_SNAP_BOOT)
+        || (emulatorSnapshotGet64(bootSnap) != bootKey)) {
+      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+          "Boot snapshot %s does not match this configuration", bootFile);
+      emulatorSnapshotClose(bootSnap);
+      bootSnap = NULL;
+    } else if (!emulatorSnapshotDecodeRam(bootSnap)) {
+      emulatorSnapshotClose(bootSnap);
+      bootSnap = NULL;
+      emulatorBootSnapshotDiscard();
+    } else {
+      return;
+    }
+  }
+
+  emulatorBootSnapshotArm();
+}
+
+bool emulatorBootSnapshotPending(void)
+{
+  return bootSnap != NULL;
+}
+
+bool emulatorBootSnapshotRestore(void)
+{
+  emulator_snapshot_t* snap = bootSnap;
+
+  bootSnap = NULL;
+  if (!snap) {
+    return false;
+  }
+
+  if (emulatorSnapshotApply(snap, bootFile)) {
+    return true;
+  }
+
+  // the machine is still as it booted, carry on and take a new one
+  emulatorBootSnapshotDiscard();
+  emulatorBootSnapshotArm();
+
+  return false;
+}
+
+void emulatorBootSnapshotHook(unsigned int pc)
+{
+  if (pc != bootPc) {
+    return;
+  }
+
+  emulatorBootCapture = false;
+  bootDue = true;
+
+  // finish the slice so the main loop gets to take the snapshot
+  m68k_modify_timeslice(-m68k_cycles_remaining());
+}
+
+void emulatorBootSnapshotFrame(void)
+{
+  if ((bootFrames > 0) && (--bootFrames == 0)) {
+    bootDue = true;
+  }
+}
+
+void emulatorBootSnapshotPoll(void)
+{
+  if (!bootDue) {
+    return;
+  }
+
+  bootDue = false;
+
+  // the guest may have written to its cards while booting
+  sdImageSyncAll();
+  bootKey = emulatorBootSnapshotKey();
+  emulatorSnapshotWrite(bootFile, &bootKey);
+}
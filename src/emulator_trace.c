@@ -81,6 +81,23 @@ static const char* traceSymbol(int addr)
   }
 }
 
+// reverse lookup of a trace-map symbol
+bool emulatorTraceLookup(const char* name, unsigned int* addr)
+{
+  struct trace_entry* traceEntry;
+  struct trace_entry* tmp;
+
+  HASH_ITER(hh, traceHash, traceEntry, tmp)
+  {
+    if (SDL_strcmp(traceEntry->name, name) == 0) {
+      *addr = traceEntry->addr;
+      return true;
+    }
+  }
+
+  return false;
+}
+
 void emulatorTraceToggle(void)
 {
   trace = !trace;
@@ -16,8 +16,8 @@
 // clang-format on
 #include "spi_sdcard.h"
 
-SDL_IOStream* sd1Stream = NULL;
-SDL_IOStream* sd2Stream = NULL;
+emulator_sdimage_t* sd1Image = NULL;
+emulator_sdimage_t* sd2Image = NULL;
 
 bool q68DiskInitialise(void)
 {
@@ -25,8 +25,9 @@ bool q68DiskInitialise(void)
   if (!diskName || (strlen(diskName) == 0)) {
     SDL_LogDebug(Q68_LOG_DISK, "No SD card specified for SD1");
   } else {
-    sd1Stream = SDL_IOFromFile(diskName, "r+b");
-    if (sd1Stream == NULL) {
+    sd1Image = sdImageOpen(diskName,
+        emulatorOptionString("sd1-overlay"));
+    if (sd1Image == NULL) {
       SDL_LogError(Q68_LOG_DISK,
           "Failed to open SD1 image: %s %s",
           diskName, SDL_GetError());
@@ -38,8 +39,9 @@ bool q68DiskInitialise(void)
   if (!diskName || (strlen(diskName) == 0)) {
     SDL_LogDebug(Q68_LOG_DISK, "No SD card specified for SD2");
   } else {
-    sd2Stream = SDL_IOFromFile(diskName, "r+b");
-    if (sd2Stream == NULL) {
+    sd2Image = sdImageOpen(diskName,
+        emulatorOptionString("sd2-overlay"));
+    if (sd2Image == NULL) {
       SDL_LogError(Q68_LOG_DISK,
           "Failed to open SD2 card: %s %s", diskName,
           SDL_GetError());
@@ -47,7 +49,7 @@ bool q68DiskInitialise(void)
     }
   }
 
-  card_initialise(sd1Stream, sd2Stream);
+  card_initialise(sd1Image, sd2Image);
 
   return true;
 }
@@ -154,17 +156,11 @@ DRESULT disk_read(BYTE pdrv, /* [IN] Physical drive number */
       "disk_read: pdrv=%d, sector=%" PRIu64 ", count=%" PRIu64,
       pdrv, (Uint64)sector, (Uint64)count);
 
-  Sint64 resSeek = SDL_SeekIO(sd1Stream, sector * 512, SDL_IO_SEEK_SET);
-  if (resSeek < 0) {
-    SDL_LogError(Q68_LOG_DISK, "Failed to seek SD1: %s",
-        SDL_GetError());
-    return RES_ERROR;
-  }
-
-  size_t resRead = SDL_ReadIO(sd1Stream, buff, count * 512);
-  if (resRead != count * 512) {
-    SDL_LogError(Q68_LOG_DISK, "Failed to read SD1: %s",
-        SDL_GetError());
+  if (!sd1Image
+      || !sdImageRead(sd1Image, (uint64_t)sector * 512, buff,
+          (size_t)count * 512)) {
+    SDL_LogError(Q68_LOG_DISK, "Failed to read SD1 sector %" PRIu64,
+        (Uint64)sector);
     return RES_ERROR;
   }
 
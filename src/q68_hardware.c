@@ -10,8 +10,11 @@
 #include <time.h>
 
 #include "emulator_hardware.h"
+#include "emulator_hle.h"
 #include "emulator_logging.h"
+#include "emulator_memory.h"
 #include "emulator_screen.h"
+#include "m68k.h"
 #include "q68_keyboard.h"
 #include "q68_sd.h"
 #include "q68_sound.h"
@@ -39,6 +42,23 @@ static Uint8 mmc2Cnt = 0;
 static Uint8 mmc2Dout = 0;
 static Uint8 mmc2Din = 0;
 
+/*
+ * spi-hle replaces the guest's bit-banged byte loops on Q68_MMCx_CLK,
+ * byte exchanges out,in with the low byte of each register, read and
+ * write move count bytes at addr,count and leave addr past the block.
+ */
+enum {
+  Q68_SPI_HLE_BYTE,
+  Q68_SPI_HLE_READ,
+  Q68_SPI_HLE_WRITE,
+};
+
+static const char* const q68SpiHleOps[] = { "byte", "read", "write", NULL };
+// read and write counts are 16 bit
+static uint8_t q68SpiHleData[0x10000];
+
+static bool q68SpiHle(const emulator_hle_t* hle);
+
 static uint32_t q68_update_time(void)
 {
   struct timeval tv;
@@ -66,6 +86,76 @@ bool q68InitHardware(void)
 
   perfDiv = (double)perfFreq / 40000000.0;
 
+  emulatorHleInit("spi-hle", q68SpiHleOps, q68SpiHle);
+
+  return true;
+}
+
+// a byte over the bit-banged port, leaving it as after the eighth clock
+static uint8_t q68SpiExchange(int cardno, uint8_t out)
+{
+  uint8_t in;
+
+  if (cardno == 0) {
+    if (!sd1en) {
+      return 0xff;
+    }
+    in = card_byte_out(0);
+    card_byte_in(0, out);
+    mmc1Din = in << 7;
+    mmc1Dout = out;
+    mmc1Cnt = 0;
+  } else {
+    if (!sd2en) {
+      return 0xff;
+    }
+    in = card_byte_out(1);
+    card_byte_in(1, out);
+    mmc2Din = in << 7;
+    mmc2Dout = out;
+    mmc2Cnt = 0;
+  }
+
+  return in;
+}
+
+static bool q68SpiHle(const emulator_hle_t* hle)
+{
+  int cardno = hle->unit - 1;
+  uint32_t addr = emulatorHleReg(hle, 0);
+  uint32_t count = emulatorHleReg(hle, 1) & 0xffff;
+
+  if ((cardno < 0) || (cardno > 1)) {
+    return false;
+  }
+
+  switch (hle->op) {
+  case Q68_SPI_HLE_BYTE: {
+    uint8_t in = q68SpiExchange(cardno, addr & 0xff);
+
+    emulatorHleSetReg(hle, 1, (emulatorHleReg(hle, 1) & ~0xffU) | in);
+    break;
+  }
+  case Q68_SPI_HLE_READ:
+    for (uint32_t i = 0; i < count; i++) {
+      q68SpiHleData[i] = q68SpiExchange(cardno, 0xff);
+    }
+    emulatorMemoryWrite(addr, q68SpiHleData, count);
+    emulatorHleSetReg(hle, 0, addr + count);
+    break;
+  case Q68_SPI_HLE_WRITE:
+    emulatorMemoryRead(addr, q68SpiHleData, count);
+    for (uint32_t i = 0; i < count; i++) {
+      q68SpiExchange(cardno, q68SpiHleData[i]);
+    }
+    emulatorHleSetReg(hle, 0, addr + count);
+    break;
+  default:
+    return false;
+  }
+
+  emulatorHleReturn(0);
+
   return true;
 }
 
@@ -173,6 +263,9 @@ void qlHardwareWrite8(unsigned int addr, uint8_t val)
     }
     return;
   case Q68_MMC1_CS:
+    if (sd1en && !val) {
+      card_deselect(0);
+    }
     sd1en = !!val;
     SDL_LogDebug(Q68_LOG_HW, "Q68_MMC1_CS: %2.2x", val);
     break;
@@ -209,6 +302,9 @@ void qlHardwareWrite8(unsigned int addr, uint8_t val)
     }
     break;
   case Q68_MMC2_CS:
+    if (sd2en && !val) {
+      card_deselect(1);
+    }
     sd2en = !!val;
     SDL_LogDebug(Q68_LOG_HW, "Q68_MMC2_CS: %2.2x", val);
     break;
@@ -260,3 +356,57 @@ void qlHardwareWrite8(unsigned int addr, uint8_t val)
     break;
   }
 }
+
+void emulatorHardwareSnapshotSave(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_HW);
+  emulatorSnapshotPut8(snap, EMU_PC_INTR);
+  emulatorSnapshotPut8(snap, q68_mc_stat);
+  emulatorSnapshotPut8(snap, Q68_KBD_STATUS);
+  emulatorSnapshotPut8(snap, q68_q68_dmode);
+  emulatorSnapshotPut8(snap, EMU_Q68_MMC1_READ);
+  emulatorSnapshotPut8(snap, EMU_Q68_MMC1_WRIT);
+  emulatorSnapshotPut8(snap, EMU_Q68_MMC1_DOUT);
+  emulatorSnapshotPut8(snap, sd1en);
+  emulatorSnapshotPut8(snap, mmc1Clk);
+  emulatorSnapshotPut8(snap, mmc1Cnt);
+  emulatorSnapshotPut8(snap, mmc1Dout);
+  emulatorSnapshotPut8(snap, mmc1Din);
+  emulatorSnapshotPut8(snap, EMU_Q68_MMC2_READ);
+  emulatorSnapshotPut8(snap, EMU_Q68_MMC2_WRIT);
+  emulatorSnapshotPut8(snap, EMU_Q68_MMC2_DOUT);
+  emulatorSnapshotPut8(snap, sd2en);
+  emulatorSnapshotPut8(snap, mmc2Clk);
+  emulatorSnapshotPut8(snap, mmc2Cnt);
+  emulatorSnapshotPut8(snap, mmc2Dout);
+  emulatorSnapshotPut8(snap, mmc2Din);
+  emulatorSnapshotEnd(snap);
+}
+
+void emulatorHardwareSnapshotLoad(emulator_snapshot_t* snap)
+{
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_HW)) {
+    return;
+  }
+
+  EMU_PC_INTR = emulatorSnapshotGet8(snap);
+  q68_mc_stat = emulatorSnapshotGet8(snap);
+  Q68_KBD_STATUS = emulatorSnapshotGet8(snap);
+  q68_q68_dmode = emulatorSnapshotGet8(snap);
+  EMU_Q68_MMC1_READ = emulatorSnapshotGet8(snap);
+  EMU_Q68_MMC1_WRIT = emulatorSnapshotGet8(snap);
+  EMU_Q68_MMC1_DOUT = emulatorSnapshotGet8(snap);
+  sd1en = emulatorSnapshotGet8(snap);
+  mmc1Clk = emulatorSnapshotGet8(snap);
+  mmc1Cnt = emulatorSnapshotGet8(snap) & 7;
+  mmc1Dout = emulatorSnapshotGet8(snap);
+  mmc1Din = emulatorSnapshotGet8(snap);
+  EMU_Q68_MMC2_READ = emulatorSnapshotGet8(snap);
+  EMU_Q68_MMC2_WRIT = emulatorSnapshotGet8(snap);
+  EMU_Q68_MMC2_DOUT = emulatorSnapshotGet8(snap);
+  sd2en = emulatorSnapshotGet8(snap);
+  mmc2Clk = emulatorSnapshotGet8(snap);
+  mmc2Cnt = emulatorSnapshotGet8(snap) & 7;
+  mmc2Dout = emulatorSnapshotGet8(snap);
+  mmc2Din = emulatorSnapshotGet8(snap);
+}
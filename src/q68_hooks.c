@@ -1,12 +1,27 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "emulator_bench.h"
+#include "emulator_hle.h"
+#include "emulator_idle.h"
+#include "emulator_snapshot.h"
 #include "emulator_trace.h"
 #include "m68k.h"
 
 void emu_hook_pc(unsigned int pc)
 {
-  (void)pc; // Suppress unused parameter warning
-
+  emulatorInstructions++;
   emulatorTrace();
+
+  if (emulatorHleActive && emulatorHleHook(pc)) {
+    return;
+  }
+
+  if (emulatorIdleDetect) {
+    emulatorIdleHook(pc);
+  }
+
+  if (emulatorBootCapture) {
+    emulatorBootSnapshotHook(pc);
+  }
 }
@@ -40,3 +40,32 @@ void emulatorProcessKey(int keysym, int scancode, bool pressed)
     utarray_push_back(q68_kbd_queue, &key);
   }
 }
+
+/*
+ * Only the codes queued for the guest are kept, the host's keys held
+ * down right now stay as they are so nothing sticks after a restore.
+ */
+void emulatorKeyboardSnapshotSave(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_KEYBOARD);
+  emulatorSnapshotPut32(snap, utarray_len(q68_kbd_queue));
+  for (unsigned int i = 0; i < utarray_len(q68_kbd_queue); i++) {
+    emulatorSnapshotPut32(snap, *(int*)utarray_eltptr(q68_kbd_queue, i));
+  }
+  emulatorSnapshotEnd(snap);
+}
+
+void emulatorKeyboardSnapshotLoad(emulator_snapshot_t* snap)
+{
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_KEYBOARD)) {
+    return;
+  }
+
+  uint32_t count = emulatorSnapshotGet32(snap);
+
+  utarray_clear(q68_kbd_queue);
+  for (uint32_t i = 0; (i < count) && !emulatorSnapshotFailed(snap); i++) {
+    int key = emulatorSnapshotGet32(snap);
+    utarray_push_back(q68_kbd_queue, &key);
+  }
+}
@@ -6,13 +6,17 @@
 
 #include <SDL3/SDL.h>
 
+#include "emulator_bench.h"
 #include "emulator_events.h"
 #include "emulator_files.h"
 #include "emulator_hardware.h"
+#include "emulator_idle.h"
 #include "emulator_keyboard.h"
 #include "emulator_memory.h"
 #include "emulator_options.h"
 #include "emulator_screen.h"
+#include "emulator_sdimage.h"
+#include "emulator_snapshot.h"
 #include "m68k.h"
 #include "q68_disk.h"
 #include "q68_hooks.h"
@@ -22,9 +26,14 @@
 #include "spi_sdcard.h"
 #include "utarray.h"
 
+// nominal Q68 68000 clock, used to pace frames when benchmarking
+#define Q68_CPU_CLOCK 40000000
+#define Q68_FRAME_CYCLES (Q68_CPU_CLOCK / 50)
+
 typedef struct {
   uint64_t screenTick;
   uint64_t screenThen;
+  uint64_t frameCycles;
 } emulator_state_t;
 
 uint32_t msClk = 0;
@@ -50,6 +59,7 @@ void* emulatorInitEmulation(void)
     emulatorLoadFile(sysrom,
         &emulatorMemorySpace()[Q68_SYSROM_ADDR], 0);
     romProtect = true;
+    emulatorMemoryMapUpdate();
   } else {
     initPc = q68DiskReadSMSQE();
 
@@ -80,22 +90,53 @@ void* emulatorInitEmulation(void)
   return emu_state;
 }
 
+void emulatorExitEmulation(void)
+{
+  // the SD card images are closed by sdImageCloseAll
+}
+
 bool emulatorInteration(void* state)
 {
   emulator_state_t* emu_state = (emulator_state_t*)state;
   bool irq = false;
 
-  m68k_execute(50000);
-  uint64_t now = SDL_GetPerformanceCounter();
+  uint64_t instructions = emulatorInstructions;
+  int bucket = emulatorBenchSwitch(EMU_BENCH_CPU);
+  int ran = m68k_execute(50000);
+  emulatorBenchSwitch(EMU_BENCH_DEVICE);
+
+  // a spinning or stopped guest waits for the next interrupt
+  bool idle = emulatorIdleTake()
+      || (emulatorIdleDetect && (emulatorInstructions == instructions));
+
+  bool frame;
+
+  // benchmarks run flat out so frames come from the cycle count
+  if (emulatorBenchEnabled()) {
+    emu_state->frameCycles += ran;
+    frame = emu_state->frameCycles >= Q68_FRAME_CYCLES;
 
-  if ((now - emu_state->screenThen) > emu_state->screenTick) {
+    if (frame) {
+      emu_state->frameCycles -= Q68_FRAME_CYCLES;
+    }
+  } else {
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    frame = (now - emu_state->screenThen) > emu_state->screenTick;
+  }
+
+  if (frame) {
+    emulatorBenchSwitch(EMU_BENCH_RENDER);
     emulatorUpdatePixelBuffer();
     emulatorRenderScreen();
+    emulatorBenchSwitch(EMU_BENCH_DEVICE);
 
     EMU_PC_INTR |= PC_INTRF;
     irq = true;
 
     emu_state->screenThen += emu_state->screenTick;
+    emulatorBenchFrame();
+    emulatorBootSnapshotFrame();
   }
 
   if (utarray_len(q68_kbd_queue)) {
@@ -106,6 +147,44 @@ bool emulatorInteration(void* state)
   if (irq) {
     m68k_set_irq(2);
     irq = false;
+  } else if (idle && !emulatorBenchEnabled()) {
+    // a waiting guest is a good time to write back the SD cards
+    sdImageFlushAll();
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t next = emu_state->screenThen + emu_state->screenTick;
+
+    if (next > now) {
+      SDL_DelayNS(((next - now) * SDL_NS_PER_SECOND)
+          / SDL_GetPerformanceFrequency());
+    }
   }
+
+  emulatorBenchSwitch(bucket);
   return true;
 }
+
+void emulatorMachineSave(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_SCREEN);
+  emulatorSnapshotPutRegion(snap, emulatorScreenSpace(), Q68_SCREEN_SIZE);
+  emulatorSnapshotEnd(snap);
+
+  emulatorHardwareSnapshotSave(snap);
+  emulatorKeyboardSnapshotSave(snap);
+  card_snapshot_save(snap);
+}
+
+void emulatorMachineLoad(emulator_snapshot_t* snap)
+{
+  if (emulatorSnapshotFind(snap, EMU_SNAP_SCREEN)) {
+    emulatorSnapshotGetRegion(snap, emulatorScreenSpace(), Q68_SCREEN_SIZE);
+  }
+
+  emulatorHardwareSnapshotLoad(snap);
+  emulatorKeyboardSnapshotLoad(snap);
+  card_snapshot_load(snap);
+
+  // the interrupt line is never lowered once the first frame raises it
+  m68k_set_irq(2);
+}
@@ -19,6 +19,9 @@ static uint8_t* q68MemorySpace = NULL;
 static uint8_t* q68ScreenSpace = NULL;
 bool romProtect = false;
 
+emulator_page_t emulatorPages[EMU_PAGE_COUNT];
+uint32_t emulatorWriteCount = 0;
+
 uint8_t* emulatorMemorySpace(void)
 {
   return q68MemorySpace;
@@ -29,15 +32,67 @@ uint8_t* emulatorScreenSpace(void)
   return q68ScreenSpace;
 }
 
+size_t emulatorMemorySize(void)
+{
+  return Q68_RAM_SIZE;
+}
+
 int emulatorInitMemory(void)
 {
   q68MemorySpace = calloc(Q68_RAM_SIZE, 1);
   q68ScreenSpace = calloc(Q68_SCREEN_SIZE, 1);
 
+  emulatorMemoryMapUpdate();
+
   return 0;
 }
 
-unsigned int m68k_read_memory_8(unsigned int address)
+/*
+ * Rebuild the page table, called whenever romProtect changes. The page
+ * holding the internal and external IO is always decoded in full.
+ */
+void emulatorMemoryMapUpdate(void)
+{
+  SDL_memset(emulatorPages, 0, sizeof(emulatorPages));
+
+  for (uint32_t base = 0; base < Q68_RAM_SIZE; base += EMU_PAGE_SIZE) {
+    emulator_page_t* entry = &emulatorPages[base >> EMU_PAGE_SHIFT];
+
+    // internal and external IO share this page
+    if ((base < (QL_EXTERNAL_IO + QL_EXTERNAL_IO_SIZE)) && ((base + EMU_PAGE_SIZE) > QL_INTERNAL_IO)) {
+      continue;
+    }
+
+    entry->read = &q68MemorySpace[base];
+    if (!romProtect || (base > Q68_ROM_SIZE)) {
+      entry->write = &q68MemorySpace[base];
+    }
+
+    // the QL compatible screens
+    if (base == 0x20000) {
+      entry->dirty = &emulatorScreenDirty[EMU_DIRTY_QL / 32];
+    }
+  }
+
+  for (uint32_t base = 0; base < Q68_SCREEN_SIZE; base += EMU_PAGE_SIZE) {
+    emulator_page_t* entry = &emulatorPages[(Q68_SCREEN + base) >> EMU_PAGE_SHIFT];
+
+    entry->read = &q68ScreenSpace[base];
+    entry->write = &q68ScreenSpace[base];
+    entry->dirty = &emulatorScreenDirty[(EMU_DIRTY_Q68 + (base >> EMU_DIRTY_SHIFT)) / 32];
+  }
+}
+
+static void q68MarkDirty(unsigned int address)
+{
+  emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+
+  if (page->dirty) {
+    EMU_PAGE_MARK_DIRTY(page, address & EMU_PAGE_MASK);
+  }
+}
+
+static unsigned int q68ReadSlow8(unsigned int address)
 {
   if ((address >= QL_INTERNAL_IO) && address < (QL_INTERNAL_IO + QL_INTERNAL_IO_SIZE)) {
     return qlHardwareRead8(address);
@@ -62,7 +117,7 @@ unsigned int m68k_read_memory_8(unsigned int address)
   return q68MemorySpace[address];
 }
 
-unsigned int m68k_read_memory_16(unsigned int address)
+static unsigned int q68ReadSlow16(unsigned int address)
 {
   if ((address >= QL_INTERNAL_IO) && address < (QL_INTERNAL_IO + QL_INTERNAL_IO_SIZE)) {
     return ((uint16_t)qlHardwareRead8(address) << 8) | qlHardwareRead8(address + 1);
@@ -97,7 +152,7 @@ unsigned int m68k_read_disassembler_16(unsigned int address)
   return SDL_Swap16BE(*(uint16_t*)&q68MemorySpace[address]);
 }
 
-unsigned int m68k_read_memory_32(unsigned int address)
+static unsigned int q68ReadSlow32(unsigned int address)
 {
   if ((address >= QL_INTERNAL_IO) && address < (QL_INTERNAL_IO + QL_INTERNAL_IO_SIZE)) {
     return ((uint32_t)qlHardwareRead8(address) << 24) | ((uint32_t)qlHardwareRead8(address + 1) << 16) | ((uint32_t)qlHardwareRead8(address + 2) << 8) | ((uint32_t)qlHardwareRead8(address + 3) << 0);
@@ -132,7 +187,7 @@ unsigned int m68k_read_disassembler_32(unsigned int address)
   return SDL_Swap32BE(*(uint32_t*)&q68MemorySpace[address]);
 }
 
-void m68k_write_memory_8(unsigned int address, unsigned int value)
+static void q68WriteSlow8(unsigned int address, unsigned int value)
 {
   if (romProtect && (address <= Q68_ROM_SIZE)) {
     return;
@@ -165,7 +220,7 @@ void m68k_write_memory_8(unsigned int address, unsigned int value)
   emulatorMemorySpace()[address] = value;
 }
 
-void m68k_write_memory_16(unsigned int address, unsigned int value)
+static void q68WriteSlow16(unsigned int address, unsigned int value)
 {
   if (romProtect && (address <= Q68_ROM_SIZE)) {
     return;
@@ -201,7 +256,7 @@ void m68k_write_memory_16(unsigned int address, unsigned int value)
   *(uint16_t*)&q68MemorySpace[address] = SDL_Swap16BE(value);
 }
 
-void m68k_write_memory_32(unsigned int address, unsigned int value)
+static void q68WriteSlow32(unsigned int address, unsigned int value)
 {
   if (romProtect && (address <= Q68_ROM_SIZE)) {
     return;
@@ -242,3 +297,100 @@ void m68k_write_memory_32(unsigned int address, unsigned int value)
 
   *(uint32_t*)&q68MemorySpace[address] = SDL_Swap32BE(value);
 }
+
+unsigned int m68k_read_memory_8(unsigned int address)
+{
+  const emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+
+  if (page->read) {
+    return page->read[address & EMU_PAGE_MASK];
+  }
+
+  return q68ReadSlow8(address);
+}
+
+unsigned int m68k_read_memory_16(unsigned int address)
+{
+  const emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+  unsigned int offset = address & EMU_PAGE_MASK;
+
+  if (page->read && (offset <= (EMU_PAGE_SIZE - 2))) {
+    return SDL_Swap16BE(*(const uint16_t*)&page->read[offset]);
+  }
+
+  return q68ReadSlow16(address);
+}
+
+unsigned int m68k_read_memory_32(unsigned int address)
+{
+  const emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+  unsigned int offset = address & EMU_PAGE_MASK;
+
+  if (page->read && (offset <= (EMU_PAGE_SIZE - 4))) {
+    return SDL_Swap32BE(*(const uint32_t*)&page->read[offset]);
+  }
+
+  return q68ReadSlow32(address);
+}
+
+void m68k_write_memory_8(unsigned int address, unsigned int value)
+{
+  emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+
+  emulatorWriteCount++;
+
+  if (page->write) {
+    if (page->dirty) {
+      EMU_PAGE_MARK_DIRTY(page, address & EMU_PAGE_MASK);
+    }
+
+    page->write[address & EMU_PAGE_MASK] = value;
+    return;
+  }
+
+  q68WriteSlow8(address, value);
+}
+
+void m68k_write_memory_16(unsigned int address, unsigned int value)
+{
+  emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+  unsigned int offset = address & EMU_PAGE_MASK;
+
+  emulatorWriteCount++;
+
+  if (page->write && (offset <= (EMU_PAGE_SIZE - 2))) {
+    if (page->dirty) {
+      EMU_PAGE_MARK_DIRTY(page, offset);
+      EMU_PAGE_MARK_DIRTY(page, offset + 1);
+    }
+
+    *(uint16_t*)&page->write[offset] = SDL_Swap16BE(value);
+    return;
+  }
+
+  q68MarkDirty(address);
+  q68MarkDirty(address + 1);
+  q68WriteSlow16(address, value);
+}
+
+void m68k_write_memory_32(unsigned int address, unsigned int value)
+{
+  emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+  unsigned int offset = address & EMU_PAGE_MASK;
+
+  emulatorWriteCount++;
+
+  if (page->write && (offset <= (EMU_PAGE_SIZE - 4))) {
+    if (page->dirty) {
+      EMU_PAGE_MARK_DIRTY(page, offset);
+      EMU_PAGE_MARK_DIRTY(page, offset + 3);
+    }
+
+    *(uint32_t*)&page->write[offset] = SDL_Swap32BE(value);
+    return;
+  }
+
+  q68MarkDirty(address);
+  q68MarkDirty(address + 3);
+  q68WriteSlow32(address, value);
+}
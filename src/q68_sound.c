@@ -6,6 +6,7 @@
 
 #include <SDL3/SDL.h>
 
+#include "emulator_bench.h"
 #include "emulator_logging.h"
 #include "emulator_options.h"
 
@@ -17,6 +18,13 @@ bool q68InitSound(void)
   SDL_AudioSpec audio_spec, spec;
 
   SDL_LogDebug(Q68_LOG_SOUND, "Init SSS sound");
+
+  // the null audio backend, SSS writes are dropped without a stream
+  if (emulatorBenchEnabled()) {
+    SDL_LogDebug(Q68_LOG_SOUND, "Audio disabled for benchmark");
+    return true;
+  }
+
   audio_dev = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
   if (!audio_dev) {
     SDL_LogError(Q68_LOG_SOUND, "Couldn't open audio device: %s",
@@ -69,6 +77,8 @@ static Uint8 sound_buffer[2] = { 0 };
 
 void q68PlayByte(int channel, Uint8 byte)
 {
+  int bucket = emulatorBenchSwitch(EMU_BENCH_AUDIO);
+
   switch (channel) {
   case 0:
     if (sss_stream) {
@@ -90,4 +100,6 @@ void q68PlayByte(int channel, Uint8 byte)
     SDL_LogError(Q68_LOG_SOUND, "Unknown SSS channel %d", channel);
     break;
   }
+
+  emulatorBenchSwitch(bucket);
 }
@@ -15,7 +15,8 @@
 
 #include "emulator_memory.h"
 #include "emulator_options.h"
-#include "m68k.h"
+#include "uthash.h"
+#include "utlist.h"
 
 static const char* winfn[8] = { "", "", "", "", "", "", "", "" };
 
@@ -35,6 +36,10 @@ static int store_dir(int drivenr, int offset, int bytecnt);
 static int get_dir(int drivenr, int offset, int bytecnt);
 static int fnum2fname(int drivenr, int fnum, char* fname);
 static int fnum2dirname(int drivenr, char* fname);
+static FILE* nfaOpen(int drivenr, int filenum, int mode);
+static void nfaClose(int drivenr, int filenum);
+static void nfaDirUpdate(int drivenr, int offset, int bytecnt);
+static uint8_t* nfaWindow(int bytenum, int bytecnt);
 
 #define END_CMD 0x00
 #define RD_CMD 0x81
@@ -60,12 +65,43 @@ static int fnum2dirname(int drivenr, char* fname);
 #define MAXDRIVE 8
 #define MAXDLEN (512 * 20)
 #define MAXFNLEN (255 + 37) /* drive + directory + file */
+#define MAXDENT (MAXDLEN / 64)
+#define NAMELEN 36
+#define NFA_FILES 8 /* host files kept open between commands */
+
+/* nfaOpen modes */
+#define NFA_READ 0
+#define NFA_UPDATE 1 /* must already exist */
+#define NFA_CREATE 2 /* created when missing */
+
+/* open host file, found by drive * 65536 + file number */
+typedef struct nfa_file {
+  int key;
+  FILE* fp;
+  int writable;
+  struct nfa_file* prev;
+  struct nfa_file* next;
+  UT_hash_handle hh;
+} nfa_file_t;
+
+/* name of a directory record, indexed by name while it has one */
+typedef struct nfa_dent {
+  char name[NAMELEN + 1];
+  int fnum;
+  UT_hash_handle hh;
+} nfa_dent_t;
 
 static uint8_t dir[MAXDRIVE][MAXDLEN];
 static uint8_t sector[512];
 static FILE* nfa;
 static char* filename;
 
+static nfa_file_t nfaFiles[NFA_FILES];
+static nfa_file_t* nfaFileHash = NULL;
+static nfa_file_t* nfaFileLru = NULL;
+static nfa_dent_t dents[MAXDRIVE][MAXDENT];
+static nfa_dent_t* dentHash[MAXDRIVE];
+
 void qlayInitDisk(void)
 {
   int i;
@@ -102,6 +138,129 @@ void qlayInitDisk(void)
   filename = calloc(256, 1);
 }
 
+void exit_qldisk(void)
+{
+  int i;
+
+  for (i = 0; i < NFA_FILES; i++) {
+    if (nfaFiles[i].fp != NULL) {
+      nfaClose(nfaFiles[i].key >> 16, nfaFiles[i].key & 0xffff);
+    }
+  }
+}
+
+/* cached handle of a file, positioned at 0 */
+/* any mode but NFA_READ opens it for update */
+FILE* nfaOpen(int drivenr, int filenum, int mode)
+{
+  nfa_file_t* f;
+  FILE* fp;
+  int key = (drivenr << 16) | filenum;
+  int writable = 1;
+  int i;
+
+  HASH_FIND_INT(nfaFileHash, &key, f);
+  if (f != NULL) {
+    if ((mode != NFA_READ) && !f->writable) {
+      nfaClose(drivenr, filenum);
+    } else {
+      if (nfaFileLru != f) {
+        DL_DELETE(nfaFileLru, f);
+        DL_PREPEND(nfaFileLru, f);
+      }
+      fseek(f->fp, 0, 0);
+      return f->fp;
+    }
+  }
+
+  fnum2fname(drivenr, filenum, filename);
+  fp = fopen(filename, "rb+");
+  if ((fp == NULL) && (mode == NFA_CREATE)) {
+    fp = fopen(filename, "wb+");
+  }
+  if ((fp == NULL) && (mode == NFA_READ)) {
+    fp = fopen(filename, "rb");
+    writable = 0;
+  }
+  if (fp == NULL) {
+    return NULL;
+  }
+
+  f = NULL;
+  for (i = 0; i < NFA_FILES; i++) {
+    if (nfaFiles[i].fp == NULL) {
+      f = &nfaFiles[i];
+      break;
+    }
+  }
+  if (f == NULL) {
+    /* the list head's prev is the least recently used file */
+    f = nfaFileLru->prev;
+    nfaClose(f->key >> 16, f->key & 0xffff);
+  }
+
+  f->key = key;
+  f->fp = fp;
+  f->writable = writable;
+  HASH_ADD_INT(nfaFileHash, key, f);
+  DL_PREPEND(nfaFileLru, f);
+
+  return fp;
+}
+
+/* before the host file is renamed, removed or its name changes */
+void nfaClose(int drivenr, int filenum)
+{
+  nfa_file_t* f;
+  int key = (drivenr << 16) | filenum;
+
+  HASH_FIND_INT(nfaFileHash, &key, f);
+  if (f == NULL) {
+    return;
+  }
+
+  fclose(f->fp);
+  f->fp = NULL;
+  HASH_DELETE(hh, nfaFileHash, f);
+  DL_DELETE(nfaFileLru, f);
+}
+
+/* the sector buffer is the NFA's own memory, it is copied directly */
+/* NULL when the range does not fit in it */
+uint8_t* nfaWindow(int bytenum, int bytecnt)
+{
+  if ((bytenum < 0) || (bytecnt < 0) || (bytenum + bytecnt > 512))
+    return NULL;
+  return &emulatorMemorySpace()[SECTOR + bytenum];
+}
+
+/* reindex the records touched by store_dir by name */
+void nfaDirUpdate(int drivenr, int offset, int bytecnt)
+{
+  int i, last;
+  char name[NAMELEN + 1];
+
+  last = (offset + bytecnt - 1) / 64;
+  if (last >= MAXDENT)
+    last = MAXDENT - 1;
+  for (i = offset / 64; i <= last; i++) {
+    nfa_dent_t* d = &dents[drivenr - 1][i];
+
+    SDL_strlcpy(name, (char*)&dir[drivenr - 1][i * 64 + 16], NAMELEN + 1);
+    if (strcmp(name, d->name) == 0)
+      continue;
+
+    /* file i + 1 now has another host file */
+    nfaClose(drivenr, i + 1);
+    if (d->name[0] != '\0')
+      HASH_DELETE(hh, dentHash[drivenr - 1], d);
+    strcpy(d->name, name);
+    d->fnum = i + 1;
+    if (d->name[0] != '\0')
+      HASH_ADD_STR(dentHash[drivenr - 1], name, d);
+  }
+}
+
 /* store part of directory in 'sector' into 'dir' */
 /* return QDOS error */
 int store_dir(int drivenr, int offset, int bytecnt)
@@ -110,9 +269,13 @@ int store_dir(int drivenr, int offset, int bytecnt)
 
   for (i = 0; i < bytecnt; i++) {
     if (offset + i >= MAXDLEN)
-      return -11; /*DF*/
+      break;
     dir[drivenr - 1][offset + i] = sector[i];
   }
+  if (i > 0)
+    nfaDirUpdate(drivenr, offset, i);
+  if (i < bytecnt)
+    return -11; /*DF*/
   return 0; /*OK*/
 }
 
@@ -182,6 +345,7 @@ void wrnfa(uint32_t addr, uint8_t data)
           bytecnt);
       break;
     case DEL_CMD:
+      nfaClose(drivenr, filenum);
       fnum2fname(drivenr, filenum, filename);
       /* more checks needed... */
       r = remove(filename);
@@ -203,15 +367,15 @@ void wrnfa(uint32_t addr, uint8_t data)
       r = drvcfgnfa(drivenr);
       break;
     case RST_CMD:
+      exit_qldisk();
       r = 0;
       break;
     default:
       r = -19; /*NIyet*/
     }
     // Type cast add by Jimmy (uint32_t) & (uint8_t)
-    m68k_write_memory_8((uint32_t)0x1810a,
-        (uint8_t)((r >> 8) & 0xff));
-    m68k_write_memory_8((uint32_t)0x1810b, (uint8_t)(r & 0xff));
+    emulatorMemorySpace()[0x1810a] = (uint8_t)((r >> 8) & 0xff);
+    emulatorMemorySpace()[0x1810b] = (uint8_t)(r & 0xff);
     // draw_LED(First_Led_X - 16, First_Led_Y, LED_GREEN,
     //	 0); /* full black */
   }
@@ -237,6 +401,7 @@ int wrnfafile(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
 {
   long offset;
   int pos, i;
+  uint8_t* win;
 
   offset = OFFSET - 64;
   if (offset < 0) {
@@ -247,15 +412,14 @@ int wrnfafile(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
       offset = 0;
     }
   }
-  fnum2fname(drivenr, filenum, filename);
-  nfa = fopen(filename, "rb+");
+  win = nfaWindow(bytenum, bytecnt);
+  if (win == NULL) {
+    return -15; /*BP*/
+  }
+  nfa = nfaOpen(drivenr, filenum, NFA_CREATE);
   if (nfa == NULL) {
-    nfa = fopen(filename, "wb+");
-    if (nfa == NULL) {
-      return -7; /*NF*/
-    }
+    return -7; /*NF*/
   }
-  fseek(nfa, 0, 0);
   pos = fseek(nfa, offset, 1);
   if (pos != 0) { /*seek failed*/
     if (filenum == 0) {
@@ -263,20 +427,17 @@ int wrnfafile(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
       for (i = 0; i < offset; i++)
         putc(0, nfa);
     } else {
-      fclose(nfa);
+      nfaClose(drivenr, filenum);
       return -10; /*EOF*/
     }
   }
-  for (i = bytenum; i < bytenum + bytecnt; i++)
-    sector[i - bytenum] = emulatorMemorySpace()[i + 0x18200];
-  /* eqv:	for(i=0;i<bytecnt;i++) sector[i]=get_byte(i+bytenum+0x18200);*/
+  SDL_memcpy(sector, win, bytecnt);
 
   i = fwrite(sector, 1, bytecnt, nfa);
-  if (i != bytecnt) {
-    fclose(nfa);
+  if ((i != bytecnt) || (fflush(nfa) != 0)) {
+    nfaClose(drivenr, filenum);
     return -7; /*NF*/
   }
-  fclose(nfa);
   if (filenum == 0) {
     if (store_dir(drivenr, offset, bytecnt) < 0)
       return -11; /* DF */
@@ -287,7 +448,8 @@ int wrnfafile(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
 int rdnfafile(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
 {
   long offset;
-  int pos, i;
+  int pos;
+  uint8_t* win;
 
   offset = OFFSET - 64;
   if (offset < 0) {
@@ -299,43 +461,38 @@ int rdnfafile(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
     }
   }
 
+  win = nfaWindow(bytenum, bytecnt);
+  if (win == NULL) {
+    return -15; /*BP*/
+  }
+
   if (0)
     if (filenum == 0) {
       if (get_dir(drivenr, offset, bytecnt) < 0)
         return -7; /*NF*/
-      for (i = 0; i < bytecnt; i++)
-        m68k_write_memory_8(i + 0x18200 + bytenum,
-            sector[i]);
+      SDL_memcpy(win, sector, bytecnt);
       return 0;
     }
 
-  fnum2fname(drivenr, filenum, filename);
-  nfa = fopen(filename, "rb");
+  nfa = nfaOpen(drivenr, filenum, NFA_READ);
   if (nfa == NULL) {
     return -7; /*NF*/
   }
-  fseek(nfa, 0, 0);
   pos = fseek(nfa, offset, 0);
   if (pos != 0) { /*seekfailed*/
-    fclose(nfa);
+    nfaClose(drivenr, filenum);
     return -10; /*EOF*/
   }
-  i = fread(sector, 1, bytecnt, nfa);
-  if (i != bytecnt) {
-    /*		fclose(nfa);*/
-    /*		return -7 */ /*NF*/;
-    bytecnt = i;
+  if (fread(win, 1, bytecnt, nfa) < (size_t)bytecnt) {
+    /* short reads leave the rest of the window as it was */
   }
-  for (i = bytenum; i < bytenum + bytecnt; i++)
-    m68k_write_memory_8(i + 0x18200, sector[i - bytenum]);
-  fclose(nfa);
   return 0; /*OK*/
 }
 
 int gdnfa(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
 {
   long offset;
-  int i, rv;
+  int rv;
   int s0offset;
 
   offset = OFFSET - 64;
@@ -350,22 +507,17 @@ int gdnfa(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
     }
   }
 
-  fnum2fname(drivenr, filenum, filename);
-  nfa = fopen(filename, "rb");
+  nfa = nfaOpen(drivenr, filenum, NFA_READ);
   if (nfa == NULL) {
     return -7; /*NF*/
   }
-  /*	fseek(nfa,0L,0);*/
   fseek(nfa, offset, 0);
   if (ftell(nfa) != offset) { /*seekfailed*/
-    fclose(nfa);
     return 0; /* this occurs when dir file len%512=0 */
   }
   rv = fread(sector, 1, bytecnt, nfa);
 
-  for (i = bytenum; i < bytenum + rv; i++)
-    m68k_write_memory_8(i + 0x18200, sector[i - bytenum]);
-  fclose(nfa);
+  SDL_memcpy(nfaWindow(bytenum, rv), sector, rv);
   if (store_dir(drivenr, offset, rv) < 0)
     return -11; /* DF */
   return rv + s0offset; /*OK*/
@@ -389,29 +541,28 @@ int truncnfa(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
     }
   }
 
-  fnum2fname(drivenr, filenum, filename);
-  nfa = fopen(filename, "rb");
+  nfa = nfaOpen(drivenr, filenum, NFA_UPDATE);
   if (nfa == NULL) {
     return -7; /*NF*/
   }
-  /*	fseek(nfa,0L,0);*/
   pos = fseek(nfa, offset, 0);
   pos = ftell(nfa);
   if (pos < offset) { /* seekfailed? how do we get this? */
     /* should the file be extended till offset? */
-    fclose(nfa);
     return 0; /* this occurs when dir file len%512=0 */
   }
   fseek(nfa, 0L, 2);
   pos = ftell(nfa);
   if (pos > offset) {
     int res;
-    res = ftruncate(fileno(nfa), offset); /* not tested yet */
+    fflush(nfa);
+    res = ftruncate(fileno(nfa), offset);
     if (res < 0) {
       perror("truncate failed");
     }
+    /* the stream's buffer and position are stale now */
+    nfaClose(drivenr, filenum);
   }
-  fclose(nfa);
   return 0; /*OK*/
 }
 
@@ -419,11 +570,13 @@ int truncnfa(int drivenr, int filenum, int sectnum, int bytenum, int bytecnt)
 int rennfa(int drivenr, int filenum, __attribute__((unused)) int sectnum,
     __attribute__((unused)) int bytenum, int bytecnt)
 {
-  int i, rv, fnlen;
+  int rv, fnlen;
   char newname[512];
+  nfa_dent_t* d;
 
   rv = 0;
 
+  nfaClose(drivenr, filenum);
   fnum2fname(drivenr, filenum, filename);
   nfa = fopen(filename, "rb");
   if (nfa == NULL) {
@@ -431,14 +584,17 @@ int rennfa(int drivenr, int filenum, __attribute__((unused)) int sectnum,
   }
   fclose(nfa);
   fnlen = bytecnt;
-  if (fnlen > 36)
-    fnlen = 36; /* silently adjust */
-  for (i = 0; i < fnlen; i++)
-    sector[i] = emulatorMemorySpace()[i + 0x18200];
+  if (fnlen > NAMELEN)
+    fnlen = NAMELEN; /* silently adjust */
+  SDL_memcpy(sector, nfaWindow(0, fnlen), fnlen);
   sector[fnlen] = '\0';
+  /* check if already exist, in the directory or on the host */
+  HASH_FIND_STR(dentHash[drivenr - 1], (char*)sector, d);
+  if ((d != NULL) && (d->fnum != filenum)) {
+    return -8; /*AE*/
+  }
   fnum2dirname(drivenr, newname);
-  // newname.append((char *)sector);
-  /* check if already exist */
+  strncat(newname, (char*)sector, NAMELEN);
   nfa = fopen(newname, "rb");
   if (nfa != NULL) {
     fclose(nfa);
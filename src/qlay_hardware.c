@@ -8,9 +8,13 @@
 #include <sys/time.h>
 
 #include "emulator_hardware.h"
+#include "emulator_hle.h"
 #include "emulator_logging.h"
+#include "emulator_mainloop.h"
+#include "emulator_memory.h"
 #include "emulator_options.h"
 #include "emulator_screen.h"
+#include "m68k.h"
 #include "qlay_io.h"
 #include "qlay_sound.h"
 #include "spi_sdcard.h"
@@ -51,6 +55,7 @@ void qlayInitialiseQsound(void)
   if (qsound_addr != 0) {
     SDL_LogInfo(QLAY_LOG_HW, "QSound address 0x%X", qsound_addr);
     qsound_enabled = true;
+    emulatorMemoryMapUpdate();
   }
 }
 
@@ -65,6 +70,101 @@ static Uint8 QLSDByteIn = 0x00;
 static bool QLSDEnabled = false;
 static bool QLSDBG = false;
 
+// a card being let go of writes back what it has cached
+static void qlayQLSDSelect(Uint8 select)
+{
+  if (EMU_QLSD_SPI_SELECT && (EMU_QLSD_SPI_SELECT != select)) {
+    card_deselect(EMU_QLSD_SPI_SELECT - 1);
+  }
+
+  EMU_QLSD_SPI_SELECT = select;
+}
+
+/*
+ * qlsd-hle replaces the driver's background transfer loops, each byte
+ * of which is a read in the 0xFF00 window. read and write move count
+ * bytes at addr,count and leave addr past them, the block forms also
+ * clock the two CRC bytes and default to 512 bytes. Card 0 is whichever
+ * card is selected. The guest runs its own code unless background
+ * transfers are on and the card is selected.
+ */
+enum {
+  QLSD_HLE_READ,
+  QLSD_HLE_WRITE,
+  QLSD_HLE_READ_BLOCK,
+  QLSD_HLE_WRITE_BLOCK,
+};
+
+static const char* const qlsdHleOps[] = { "read", "write", "readblock",
+  "writeblock", NULL };
+// read and write counts are 16 bit
+static uint8_t qlsdHleData[0x10000];
+
+static unsigned int qlsdHleCycles;
+
+// one background transfer, as a read of QLSD_SPI_XFER + out
+static Uint8 qlayQLSDExchange(Uint8 out)
+{
+  card_byte_in(EMU_QLSD_SPI_SELECT - 1, out);
+  EMU_QLSD_SPI_READ = card_byte_out(EMU_QLSD_SPI_SELECT - 1);
+  extraCycles += qlsdHleCycles;
+
+  return EMU_QLSD_SPI_READ;
+}
+
+static bool qlayQLSDHle(const emulator_hle_t* hle)
+{
+  uint32_t addr = emulatorHleReg(hle, 0);
+  uint32_t count = emulatorHleReg(hle, 1) & 0xffff;
+  bool block = (hle->op == QLSD_HLE_READ_BLOCK)
+      || (hle->op == QLSD_HLE_WRITE_BLOCK);
+
+  if (!QLSDEnabled || !QLSDBG || !EMU_QLSD_SPI_SELECT
+      || (hle->unit && (hle->unit != EMU_QLSD_SPI_SELECT))) {
+    return false;
+  }
+
+  if (block && (hle->regCount < 2)) {
+    count = 512;
+  }
+
+  switch (hle->op) {
+  case QLSD_HLE_READ:
+  case QLSD_HLE_READ_BLOCK:
+    for (uint32_t i = 0; i < count; i++) {
+      qlsdHleData[i] = qlayQLSDExchange(0xFF);
+    }
+    extraCycles += emulatorMemoryWrite(addr, qlsdHleData, count);
+    break;
+  case QLSD_HLE_WRITE:
+  case QLSD_HLE_WRITE_BLOCK:
+    extraCycles += emulatorMemoryRead(addr, qlsdHleData, count);
+    for (uint32_t i = 0; i < count; i++) {
+      qlayQLSDExchange(qlsdHleData[i]);
+    }
+    break;
+  default:
+    return false;
+  }
+
+  // the card ignores the CRC in SPI mode
+  if (block) {
+    qlayQLSDExchange(0xFF);
+    qlayQLSDExchange(0xFF);
+  }
+
+  emulatorHleSetReg(hle, 0, addr + count);
+  emulatorHleReturn(0);
+
+  return true;
+}
+
+void qlayInitialiseQLSDHle(void)
+{
+  qlsdHleCycles = emulatorOptionInt("qlsd-hle-cycles");
+  emulatorHleInit("qlsd-hle", qlsdHleOps, qlayQLSDHle);
+}
+
 Uint8 qlHardwareRead8(unsigned int addr)
 {
   switch (addr) {
@@ -113,7 +213,7 @@ Uint8 qlHardwareRead8(unsigned int addr)
         SDL_LogDebug(QLAY_LOG_HW, "QL-SD: disabled");
         break;
       case QLSD_IF_RESET:
-        EMU_QLSD_SPI_SELECT = 0x00;
+        qlayQLSDSelect(0);
         EMU_QLSD_MOSI = 0x00;
         EMU_QLSD_CLK = 0x00;
         QLSDCount = 0;
@@ -147,20 +247,20 @@ Uint8 qlHardwareRead8(unsigned int addr)
         break;
       case QLSD_SPI_SELECT0:
         SDL_LogDebug(Q68_LOG_HW, "QL-SD: deselect");
-        EMU_QLSD_SPI_SELECT = 0;
+        qlayQLSDSelect(0);
         break;
       case QLSD_SPI_SELECT1:
-        EMU_QLSD_SPI_SELECT = 1;
+        qlayQLSDSelect(1);
         SDL_LogDebug(Q68_LOG_HW, "QL-SD: select1");
         break;
       case QLSD_SPI_SELECT2:
-        EMU_QLSD_SPI_SELECT = 2;
+        qlayQLSDSelect(2);
         SDL_LogDebug(Q68_LOG_HW, "QL-SD: select2");
         break;
       case QLSD_SPI_SELECT3:
         // we dont support card 3 yet
         // EMU_QLSD_SPI_SELECT = 3;
-        EMU_QLSD_SPI_SELECT = 0;
+        qlayQLSDSelect(0);
         SDL_LogDebug(Q68_LOG_HW, "QL-SD: select3");
         break;
       case QLSD_SPI_CLR_MOSI:
@@ -318,3 +418,57 @@ void qsoundWrite(Uint32 address, Uint8 val)
     SDL_LogDebug(QLAY_LOG_HW, "QSound control 0x%X", val);
   }
 }
+
+void emulatorHardwareSnapshotSave(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_HW);
+  emulatorSnapshotPut8(snap, EMU_PC_INTR);
+  emulatorSnapshotPut8(snap, EMU_PC_INTR_MASK);
+  emulatorSnapshotPut8(snap, EMU_MC_STAT);
+  emulatorSnapshotPut8(snap, EMU_PC_TRAK1);
+  emulatorSnapshotPut8(snap, EMU_PC_TRAK2);
+  emulatorSnapshotPut32(snap, EMU_PC_CLOCK);
+  emulatorSnapshotPut8(snap, EMU_QLSD_SPI_SELECT);
+  emulatorSnapshotPut8(snap, EMU_QLSD_MOSI);
+  emulatorSnapshotPut8(snap, EMU_QLSD_CLK);
+  emulatorSnapshotPut8(snap, EMU_QLSD_SPI_READ);
+  emulatorSnapshotPut8(snap, QLSDCount);
+  emulatorSnapshotPut8(snap, QLSDInCount);
+  emulatorSnapshotPut8(snap, QLSDByteOut);
+  emulatorSnapshotPut8(snap, QLSDByteIn);
+  emulatorSnapshotPut8(snap, QLSDEnabled);
+  emulatorSnapshotPut8(snap, QLSDBG);
+  emulatorSnapshotPut8(snap, qsound_pa_last);
+  emulatorSnapshotPut8(snap, qsound_pb_last);
+  emulatorSnapshotPut8(snap, qsound_reg_num);
+  emulatorSnapshotEnd(snap);
+}
+
+void emulatorHardwareSnapshotLoad(emulator_snapshot_t* snap)
+{
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_HW)) {
+    return;
+  }
+
+  EMU_PC_INTR = emulatorSnapshotGet8(snap);
+  EMU_PC_INTR_MASK = emulatorSnapshotGet8(snap);
+  EMU_MC_STAT = emulatorSnapshotGet8(snap);
+  EMU_PC_TRAK1 = emulatorSnapshotGet8(snap);
+  EMU_PC_TRAK2 = emulatorSnapshotGet8(snap);
+  // the clock carries on from the host time, as on the Q68
+  emulatorSnapshotGet32(snap);
+  qlayInitialiseTime();
+  EMU_QLSD_SPI_SELECT = emulatorSnapshotGet8(snap);
+  EMU_QLSD_MOSI = emulatorSnapshotGet8(snap);
+  EMU_QLSD_CLK = emulatorSnapshotGet8(snap);
+  EMU_QLSD_SPI_READ = emulatorSnapshotGet8(snap);
+  QLSDCount = emulatorSnapshotGet8(snap);
+  QLSDInCount = emulatorSnapshotGet8(snap);
+  QLSDByteOut = emulatorSnapshotGet8(snap);
+  QLSDByteIn = emulatorSnapshotGet8(snap);
+  QLSDEnabled = emulatorSnapshotGet8(snap);
+  QLSDBG = emulatorSnapshotGet8(snap);
+  qsound_pa_last = emulatorSnapshotGet8(snap);
+  qsound_pb_last = emulatorSnapshotGet8(snap);
+  qsound_reg_num = emulatorSnapshotGet8(snap);
+}
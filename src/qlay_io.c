@@ -22,21 +22,28 @@
 #include "emulator_debug.h"
 #include "emulator_files.h"
 #include "emulator_hardware.h"
+#include "emulator_hle.h"
 #include "emulator_mainloop.h"
 #include "emulator_memory.h"
 #include "emulator_options.h"
 #include "m68k.h"
 #include "qlay_hooks.h"
+#include "qlay_io.h"
 #include "qlay_keyboard.h"
+#include "qlay_scheduler.h"
 #include "qlay_sound.h"
 #include "utarray.h"
+#include "utlist.h"
 #include "utstring.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
 
-uint32_t qlay1msec = 7500 / 16;
+#ifndef _WIN32
+#include <sys/mman.h>
+#define MDV_MMAP
+#endif
 
 /* xternal? */
 uint8_t qliord_b(uint32_t a);
@@ -53,7 +60,7 @@ void wrZX8302(uint8_t x);
 static int decode_key(int key);
 static void init_mdvs(void);
 static void mdv_select(int drive);
-static void init_events(void);
+static void ser_tx_done(void);
 static void ser_rcv_init(void);
 static int ser_rcv_dequeue(int ch);
 static int ser_rcv_size(int ch);
@@ -63,6 +70,12 @@ static int IPC020 = 0; /* current return value for 18020 */
 static int IPCreturn; /* internal 8049 value */
 static int IPCcnt; /* send bit counter */
 static int IPCwfc = 1; /* wait for command */
+static int IPCrcvd = 1; /* bit marker */
+static int IPCpcmd = 0x10; /* previous */
+static int IPCbaud = 0;
+static int IPCbeepParams = 0; /* BEEP parameters received */
+static int IPCtestParams = 0; /* test parameters received */
+static int IPCtestval = 0;
 uint8_t REG18021 = 0; /* interrupt control/status register 18021 */
 static int ser12oc = 0; /* ser1,2 open: bit0: SER1, bit1: SER2 */
 bool qlayIPCBeeping = false; /* BEEP is sounding */
@@ -78,8 +91,6 @@ static uint8_t ser_rcv_buf[2][SER_RCV_LEN];
 static int ser_rcv_1st[2];
 static int ser_rcv_fill[2];
 
-uint32_t e50, emdv, emouse, esound, etx; /* events */
-
 static int ZXmode; /* ZX8302 mode; sertx,net,mdv: bit4,5 of 18002 */
 static int ZXbaud; /* ZX8302 sertx baudrate */
 static int REG18020tx; /* ZX8302 sertx read register */
@@ -161,10 +172,38 @@ struct mdvt {
   mdvstate mdvstate; /* which phase are we in */
   int mdvgapcnt; /* where are we in gap */
   struct mdvsector* data; /* pointer to data */
+  const uint8_t* map; /* QLAY image, decoded into data as sectors are used */
+  uint32_t decoded[(MDV_NOSECTS + 31) / 32]; /* sectors valid in data */
+  uint32_t dirty[(MDV_NOSECTS + 31) / 32]; /* sectors to write back */
 };
 
+/* MDI images are laid out as an array of these */
+SDL_COMPILE_TIME_ASSERT(mdvsector, sizeof(struct mdvsector) == 534);
+
 struct mdvt mdrive[MDV_NUMOFDRIVES];
 
+/* a copy of a cartridge's written sectors, saved on the write back thread */
+struct mdvcopy {
+  int sector;
+  struct mdvsector data;
+};
+
+typedef struct mdv_job {
+  const char* name;
+  mdvtype type;
+  int count;
+  struct mdv_job* next;
+  struct mdvcopy sectors[];
+} mdv_job_t;
+
+static SDL_Thread* mdvWorker = NULL;
+static SDL_Mutex* mdvLock = NULL;
+static SDL_Condition* mdvWake = NULL;
+static mdv_job_t* mdvJobs = NULL;
+static bool mdvQuit = false;
+static int mdvFlushDelay = 0; /* idle seconds before write back, 0 at motor off */
+static uint64_t mdvLastWrite = 0;
+
 const uint8_t preamble[12] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF };
 const uint8_t data_preamble[8] = { 0x00, 0x00, 0x00, 0x00,
@@ -356,15 +395,16 @@ static void mdv_select(int drive)
   if (drive == 0) {
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "MDV MOTOR OFF");
     for (int i = 0; i < 8; i++) {
-      if (mdrive[i].mdvwritten) {
+      if (mdrive[i].mdvwritten && !mdvFlushDelay) {
         // write MDV back to disk
         save_mdv_file(i);
-        mdrive[i].mdvwritten = false;
       }
     }
     mdvnum = -1;
     mdvmotor = false;
     mdvtxfl = false;
+    mdvgap = 0;
+    qlayCancelEvent(QLAY_EVENT_MDV);
 
     if (qlay_turbo_load) {
       SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "50");
@@ -380,6 +420,15 @@ static void mdv_select(int drive)
     mdrive[mdvnum].mdvgapcnt = MDV_GAP_COUNT;
     set_gap_irq();
 
+    /* keep the byte clock on a fixed grid */
+    if (!qlayEventPending(QLAY_EVENT_MDV)) {
+      uint64_t now = qlaySchedulerNow();
+
+      qlayScheduleEventAt(QLAY_EVENT_MDV,
+          now - (now % QLAY_MDV_CYCLES) + QLAY_MDV_CYCLES,
+          QLAY_MDV_CYCLES);
+    }
+
     if (qlay_turbo_load) {
       SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "0");
     }
@@ -436,9 +485,8 @@ static void wrserdata(uint8_t d)
   if (p)
     fpr("ST%ld ", cycles());
   REG18020tx |= 0x02; /* set busy */
-  etx = cycles() + 10000 * qlay1msec / ZXbaud; /* clear busy after 10 bits transmitted */
-  if (p)
-    fpr("ETX%ld ", etx);
+  /* clear busy after 10 bits transmitted */
+  qlayScheduleEvent(QLAY_EVENT_SERTX, 10 * QLAY_CPU_CLOCK / ZXbaud);
 }
 
 /*
@@ -474,7 +522,6 @@ repeat for any number of bits to be received (MSB first)
 
 void wr8049(Uint8 data)
 {
-  static int IPCrcvd = 1; /* bit marker */
   int IPCcmd;
 
   if (IPCwfc) {
@@ -565,9 +612,6 @@ fpr("%04x ",key);*/
 
 static void exec_IPCcmd(int cmd)
 {
-  static int IPCpcmd = 0x10; /* previous */
-  static int IPCbaud = 0;
-
   if (IPCpcmd == 0x0d) { /*baudr*/
     SDL_LogDebug(QLAY_LOG_IPC, "BRC: %d", cmd);
     switch (cmd) {
@@ -610,13 +654,12 @@ static void exec_IPCcmd(int cmd)
   }
 
   if (IPCpcmd == 0x0a) { /*sound*/
-    static int params = 0;
-    BEEPpars[params] = cmd;
-    SDL_LogDebug(QLAY_LOG_IPC, "B %d:%x", params, cmd);
-    params++;
-    if (params > 15) {
+    BEEPpars[IPCbeepParams] = cmd;
+    SDL_LogDebug(QLAY_LOG_IPC, "B %d:%x", IPCbeepParams, cmd);
+    IPCbeepParams++;
+    if (IPCbeepParams > 15) {
       IPCpcmd = 0x10;
-      params = 0;
+      IPCbeepParams = 0;
       qlayIPCBeepSound(BEEPpars);
     }
     IPCwfc = 1;
@@ -632,17 +675,15 @@ static void exec_IPCcmd(int cmd)
   }
 
   if (IPCpcmd == 0x0f) { /*test*/
-    static int params = 0;
-    static int testval = 0;
-    params++;
-    SDL_LogDebug(QLAY_LOG_IPC, "TP%d:%x", params, cmd);
-    testval = 16 * testval + cmd;
-    if (params > 1) {
-      SDL_LogDebug(QLAY_LOG_IPC, "RTV%02x", testval);
+    IPCtestParams++;
+    SDL_LogDebug(QLAY_LOG_IPC, "TP%d:%x", IPCtestParams, cmd);
+    IPCtestval = 16 * IPCtestval + cmd;
+    if (IPCtestParams > 1) {
+      SDL_LogDebug(QLAY_LOG_IPC, "RTV%02x", IPCtestval);
       IPCpcmd = 0x10;
-      params = 0;
-      IPCreturn = testval;
-      testval = 0; /* for next time 'round */
+      IPCtestParams = 0;
+      IPCreturn = IPCtestval;
+      IPCtestval = 0; /* for next time 'round */
       IPCcnt = 8;
       cmd = 0x10;
       IPCwfc = 1;
@@ -785,7 +826,8 @@ void qlayInitIPC(void)
 {
   init_mdvs();
   mdv_select(0);
-  init_events();
+  qlaySchedulerSetHandler(QLAY_EVENT_MDV, do_mdv_tick);
+  qlaySchedulerSetHandler(QLAY_EVENT_SERTX, ser_tx_done);
   ZXmode = 0;
   ZXbaud = 9600;
   REG18020tx = 0;
@@ -794,12 +836,43 @@ void qlayInitIPC(void)
   qlclkoff = 0;
 }
 
+/* the sector's data, decoded from a mapped image the first time it is used */
+static struct mdvsector* mdv_sector(struct mdvt* drive, int sector)
+{
+  struct mdvsector* sect = &drive->data[sector];
+
+  if (drive->decoded[sector / 32] & (1U << (sector % 32))) {
+    return sect;
+  }
+
+  const uint8_t* src = drive->map + sector * QLAY_MDV_SECTLEN;
+
+  /* skip the pre-ambles */
+  src += QLAY_MDV_PREAMBLE_SIZE;
+  memcpy(sect->header, src, QLAY_MDV_HDR_CONTENT_SIZE);
+  src += QLAY_MDV_HDR_CONTENT_SIZE + QLAY_MDV_PREAMBLE_SIZE;
+  memcpy(sect->blockheader, src, QLAY_MDV_DATA_HDR_SIZE);
+  src += QLAY_MDV_DATA_HDR_SIZE + QLAY_MDV_DATA_PREAMBLE_SIZE;
+  memcpy(sect->block, src, QLAY_MDV_DATA_CONTENT_SIZE);
+
+  drive->decoded[sector / 32] |= 1U << (sector % 32);
+
+  return sect;
+}
+
+static void mdv_decode_all(struct mdvt* drive)
+{
+  for (int i = 0; i < drive->no_sectors; i++) {
+    mdv_sector(drive, i);
+  }
+}
+
 /* load a qlay formatted MDV
  */
 static bool load_qlay_mdv_file(int fd, int mdvnum)
 {
   mdrive[mdvnum].no_sectors = QLAY_MDV_NOSECTS;
-  mdrive[mdvnum].data = malloc(sizeof(struct mdvsector) * QLAY_MDV_NOSECTS);
+  mdrive[mdvnum].data = calloc(QLAY_MDV_NOSECTS, sizeof(struct mdvsector));
   mdrive[mdvnum].type = MDV_FORMAT_QLAY;
 
   /* malloc failed for some reason */
@@ -809,6 +882,14 @@ static bool load_qlay_mdv_file(int fd, int mdvnum)
     return false;
   }
 
+#ifdef MDV_MMAP
+  void* map = mmap(NULL, QLAY_MDV_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map != MAP_FAILED) {
+    mdrive[mdvnum].map = map;
+    return true;
+  }
+#endif
+
   struct mdvsector* cursect = mdrive[mdvnum].data;
 
   for (int i = 0; i < QLAY_MDV_NOSECTS; i++) {
@@ -829,16 +910,30 @@ static bool load_qlay_mdv_file(int fd, int mdvnum)
     cursect++;
   }
 
+  memset(mdrive[mdvnum].decoded, 0xff, sizeof(mdrive[mdvnum].decoded));
+
   return true;
 }
 
-/* load a MDI formatted MDV
+/* load a MDI formatted MDV, its sectors are used where they lie
  */
 static bool load_mdi_mdv_file(int fd, int mdvnum)
 {
   mdrive[mdvnum].no_sectors = MDI_MDV_NOSECTS;
-  mdrive[mdvnum].data = malloc(sizeof(struct mdvsector) * MDI_MDV_NOSECTS);
   mdrive[mdvnum].type = MDV_FORMAT_MDI;
+  memset(mdrive[mdvnum].decoded, 0xff, sizeof(mdrive[mdvnum].decoded));
+
+#ifdef MDV_MMAP
+  /* private so writes only reach the file through save_mdv_file */
+  void* map = mmap(NULL, MDI_MDV_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+      fd, 0);
+  if (map != MAP_FAILED) {
+    mdrive[mdvnum].data = map;
+    return true;
+  }
+#endif
+
+  mdrive[mdvnum].data = malloc(sizeof(struct mdvsector) * MDI_MDV_NOSECTS);
 
   /* malloc failed for some reason */
   if (mdrive[mdvnum].data == NULL) {
@@ -847,21 +942,7 @@ static bool load_mdi_mdv_file(int fd, int mdvnum)
     return false;
   }
 
-  struct mdvsector* cursect = mdrive[mdvnum].data;
-
-  for (int i = 0; i < MDI_MDV_NOSECTS; i++) {
-    lseek(fd, i * MDI_MDV_SECTLEN, SEEK_SET);
-
-    read(fd, cursect->header, MDI_MDV_HDR_CONTENT_SIZE);
-
-    read(fd, cursect->blockheader, MDI_MDV_DATA_HDR_SIZE);
-
-    read(fd, cursect->block, MDI_MDV_DATA_CONTENT_SIZE);
-
-    cursect++;
-  }
-
-  return true;
+  return read(fd, mdrive[mdvnum].data, MDI_MDV_SIZE) == MDI_MDV_SIZE;
 }
 
 static bool load_mdv_file(const char* filename, int mdvnum)
@@ -871,6 +952,11 @@ static bool load_mdv_file(const char* filename, int mdvnum)
   bool res = false;
 
   fd = open(filename, O_RDONLY | O_BINARY);
+  if (fd < 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "Failed to load file %s", filename);
+    return false;
+  }
 
   fstat(fd, &stat);
 
@@ -895,100 +981,210 @@ static bool load_mdv_file(const char* filename, int mdvnum)
   return true;
 }
 
-static bool save_qlay_mdv_file(int fd, int mdvnum)
+/* write one sector in place, the preambles are left as they are */
+static bool save_mdv_sector(int fd, mdvtype type, const struct mdvcopy* copy)
 {
-  struct mdvsector* cursect = mdrive[mdvnum].data;
-
-  for (int i = 0; i < QLAY_MDV_NOSECTS; i++) {
-    lseek(fd, i * QLAY_MDV_SECTLEN, SEEK_SET);
+  const struct mdvsector* sect = &copy->data;
+  bool ok = true;
 
-    /* skip pre-amble */
-    lseek(fd, QLAY_MDV_PREAMBLE_SIZE, SEEK_CUR);
-    write(fd, cursect->header, QLAY_MDV_HDR_CONTENT_SIZE);
+  switch (type) {
+  case MDV_FORMAT_QLAY:
+    lseek(fd, copy->sector * QLAY_MDV_SECTLEN + QLAY_MDV_PREAMBLE_SIZE,
+        SEEK_SET);
+    ok &= write(fd, sect->header, QLAY_MDV_HDR_CONTENT_SIZE)
+        == QLAY_MDV_HDR_CONTENT_SIZE;
 
     /* skip the next pre-amble */
     lseek(fd, QLAY_MDV_PREAMBLE_SIZE, SEEK_CUR);
-    write(fd, cursect->blockheader, QLAY_MDV_DATA_HDR_SIZE);
+    ok &= write(fd, sect->blockheader, QLAY_MDV_DATA_HDR_SIZE)
+        == QLAY_MDV_DATA_HDR_SIZE;
 
     /* skip the next pre-amble */
     lseek(fd, QLAY_MDV_DATA_PREAMBLE_SIZE, SEEK_CUR);
-    write(fd, cursect->block, QLAY_MDV_DATA_CONTENT_SIZE);
-
-    cursect++;
+    ok &= write(fd, sect->block, QLAY_MDV_DATA_CONTENT_SIZE)
+        == QLAY_MDV_DATA_CONTENT_SIZE;
+    break;
+  case MDV_FORMAT_MDI:
+    lseek(fd, copy->sector * MDI_MDV_SECTLEN, SEEK_SET);
+    ok &= write(fd, sect->header, MDI_MDV_HDR_CONTENT_SIZE)
+        == MDI_MDV_HDR_CONTENT_SIZE;
+    ok &= write(fd, sect->blockheader, MDI_MDV_DATA_HDR_SIZE)
+        == MDI_MDV_DATA_HDR_SIZE;
+    ok &= write(fd, sect->block, MDI_MDV_DATA_CONTENT_SIZE)
+        == MDI_MDV_DATA_CONTENT_SIZE;
+    break;
+  default:
+    ok = false;
   }
 
-  return true;
+  return ok;
 }
 
-static bool save_mdi_mdv_file(int fd, int mdvnum)
+static void save_mdv_job(const mdv_job_t* job)
 {
-  struct mdvsector* cursect = mdrive[mdvnum].data;
+  int fd;
+  bool res = true;
+
+  fd = open(job->name, O_WRONLY | O_BINARY);
+  if (fd < 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "opening MDV for write %s", strerror(errno));
+    return;
+  }
+
+  for (int i = 0; i < job->count; i++) {
+    res &= save_mdv_sector(fd, job->type, &job->sectors[i]);
+  }
 
-  for (int i = 0; i < MDI_MDV_NOSECTS; i++) {
-    lseek(fd, i * MDI_MDV_SECTLEN, SEEK_SET);
+  close(fd);
 
-    write(fd, cursect->header, MDI_MDV_HDR_CONTENT_SIZE);
+  if (res == false) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "Failed to save file %s", job->name);
+  }
+}
 
-    write(fd, cursect->blockheader, MDI_MDV_DATA_HDR_SIZE);
+static int SDLCALL mdv_worker(void* data)
+{
+  (void)data;
 
-    write(fd, cursect->block, MDI_MDV_DATA_CONTENT_SIZE);
+  SDL_LockMutex(mdvLock);
+  while (mdvJobs || !mdvQuit) {
+    if (mdvJobs) {
+      mdv_job_t* job = mdvJobs;
 
-    cursect++;
+      LL_DELETE(mdvJobs, job);
+      SDL_UnlockMutex(mdvLock);
+
+      save_mdv_job(job);
+      SDL_free(job);
+
+      SDL_LockMutex(mdvLock);
+    } else {
+      SDL_WaitCondition(mdvWake, mdvLock);
+    }
   }
+  SDL_UnlockMutex(mdvLock);
 
-  return true;
+  return 0;
+}
+
+static void mdv_mark_dirty(int mdvnum, int sector)
+{
+  mdrive[mdvnum].dirty[sector / 32] |= 1U << (sector % 32);
+  mdrive[mdvnum].mdvwritten = true;
+  mdvLastWrite = qlaySchedulerNow();
 }
 
+/* hand the sectors written since the last save to the write back thread */
 static void save_mdv_file(int mdvnum)
 {
-  int fd;
-  bool res = false;
+  struct mdvt* drive = &mdrive[mdvnum];
+  mdv_job_t* job;
+  int count = 0;
 
-  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Saving: %s",
-      mdrive[mdvnum].name);
+  drive->mdvwritten = false;
 
-  if (mdrive[mdvnum].name == NULL) {
+  if (drive->name == NULL) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "MDV%d name (NULL)",
         mdvnum + 1);
     return;
   }
 
-  if (mdrive[mdvnum].wrprot) {
+  if (drive->wrprot) {
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
         "MDV%d write protected NOT saving", mdvnum + 1);
     return;
   }
 
-  SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "MDV Saving %s %d",
-      mdrive[mdvnum].name, mdvnum);
+  for (int i = 0; i < drive->no_sectors; i++) {
+    if (drive->dirty[i / 32] & (1U << (i % 32))) {
+      count++;
+    }
+  }
 
-  fd = open(mdrive[mdvnum].name, O_WRONLY | O_CREAT | O_BINARY);
-  if (fd < 0) {
-    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-        "opening MDV for write %s", strerror(errno));
+  if (count == 0) {
     return;
   }
 
-  switch (mdrive[mdvnum].type) {
-  case MDV_FORMAT_QLAY:
-    res = save_qlay_mdv_file(fd, mdvnum);
-    break;
-  case MDV_FORMAT_MDI:
-    res = save_mdi_mdv_file(fd, mdvnum);
-    break;
-  default:
+  job = SDL_malloc(sizeof(*job) + count * sizeof(struct mdvcopy));
+  if (job == NULL) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-        "Unknown mdv format MDV%d\n", mdvnum + 1);
+        "malloc failed %s %d", __FILE__, __LINE__);
+    return;
   }
 
-  close(fd);
+  job->name = drive->name;
+  job->type = drive->type;
+  job->count = 0;
+  for (int i = 0; i < drive->no_sectors; i++) {
+    if (drive->dirty[i / 32] & (1U << (i % 32))) {
+      job->sectors[job->count].sector = i;
+      job->sectors[job->count].data = *mdv_sector(drive, i);
+      job->count++;
+    }
+  }
+  SDL_memset(drive->dirty, 0, sizeof(drive->dirty));
 
-  if (res == false) {
-    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-        "Failed to save file %s", mdrive[mdvnum].name);
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Saving: %s %d sectors",
+      drive->name, count);
+
+  if (mdvWorker == NULL) {
+    save_mdv_job(job);
+    SDL_free(job);
+    return;
+  }
+
+  SDL_LockMutex(mdvLock);
+  LL_APPEND(mdvJobs, job);
+  SDL_SignalCondition(mdvWake);
+  SDL_UnlockMutex(mdvLock);
+}
+
+/* once a second, save cartridges left alone for mdv-flush seconds */
+void qlayMdvIdle(void)
+{
+  if (!mdvFlushDelay || mdvmotor) {
+    return;
+  }
+
+  if ((qlaySchedulerNow() - mdvLastWrite)
+      < ((uint64_t)mdvFlushDelay * QLAY_CPU_CLOCK)) {
+    return;
+  }
+
+  for (int i = 0; i < MDV_NUMOFDRIVES; i++) {
+    if (mdrive[i].mdvwritten) {
+      save_mdv_file(i);
+    }
   }
 }
 
+/* save everything and wait for it to reach the files */
+void qlayMdvQuit(void)
+{
+  for (int i = 0; i < MDV_NUMOFDRIVES; i++) {
+    if (mdrive[i].mdvwritten) {
+      save_mdv_file(i);
+    }
+  }
+
+  if (mdvWorker) {
+    SDL_LockMutex(mdvLock);
+    mdvQuit = true;
+    SDL_SignalCondition(mdvWake);
+    SDL_UnlockMutex(mdvLock);
+
+    SDL_WaitThread(mdvWorker, NULL);
+    mdvWorker = NULL;
+  }
+
+  SDL_DestroyCondition(mdvWake);
+  SDL_DestroyMutex(mdvLock);
+  mdvWake = NULL;
+  mdvLock = NULL;
+}
+
 void init_mdvs(void)
 {
   int i = 0;
@@ -1003,6 +1199,17 @@ void init_mdvs(void)
 
   memset(mdrive, 0, sizeof(mdrive));
 
+  mdvFlushDelay = emulatorOptionInt("mdv-flush");
+  mdvLock = SDL_CreateMutex();
+  mdvWake = SDL_CreateCondition();
+  if (mdvLock && mdvWake) {
+    mdvWorker = SDL_CreateThread(mdv_worker, "mdv", NULL);
+  }
+  if (mdvWorker == NULL) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+        "MDV write back thread failed, saving in line: %s", SDL_GetError());
+  }
+
   for (i = 0; i < noDrives; i++) {
     const char* drive = emulatorOptionDev("drive", i);
     const char* mdvName;
@@ -1047,9 +1254,10 @@ void init_mdvs(void)
   }
 }
 
-void init_events(void)
+/* ZX8302 has shifted the last character out */
+static void ser_tx_done(void)
 {
-  e50 = emdv = emouse = esound = etx = 0;
+  REG18020tx &= ~0x02; /* clear busy */
 }
 
 static void set_gap_irq(void)
@@ -1123,7 +1331,7 @@ void do_mdv_tick(void)
       mdvgap = 0;
       mdvrd = 1;
 
-      PC_TRAK = mdrive[mdvnum].data[sector].header[idx];
+      PC_TRAK = mdv_sector(&mdrive[mdvnum], sector)->header[idx];
 
       mdrive[mdvnum].idx++;
 
@@ -1174,12 +1382,11 @@ void do_mdv_tick(void)
       mdvgap = 0;
 
       if (mdvwrite && !wrprot) {
-        mdrive[mdvnum].data[sector].blockheader[idx] = PC_TDATA;
+        mdv_sector(&mdrive[mdvnum], sector)->blockheader[idx] = PC_TDATA;
+        mdv_mark_dirty(mdvnum, sector);
       } else {
         mdvrd = 1;
-        PC_TRAK = mdrive[mdvnum]
-                      .data[sector]
-                      .blockheader[idx];
+        PC_TRAK = mdv_sector(&mdrive[mdvnum], sector)->blockheader[idx];
       }
 
       mdrive[mdvnum].idx++;
@@ -1211,10 +1418,11 @@ void do_mdv_tick(void)
       mdvgap = 0;
 
       if (mdvwrite && !wrprot) {
-        mdrive[mdvnum].data[sector].block[idx] = PC_TDATA;
+        mdv_sector(&mdrive[mdvnum], sector)->block[idx] = PC_TDATA;
+        mdv_mark_dirty(mdvnum, sector);
       } else {
         mdvrd = 1;
-        PC_TRAK = mdrive[mdvnum].data[sector].block[idx];
+        PC_TRAK = mdv_sector(&mdrive[mdvnum], sector)->block[idx];
       }
 
       mdrive[mdvnum].idx++;
@@ -1254,3 +1462,353 @@ void do_mdv_tick(void)
     mdvgap = 0;
   }
 }
+
+/*
+ * High level microdrive access. The ROM's sector header, read, verify
+ * and write routines are replaced, whole sectors are moved to and from
+ * the cartridge in one step and the tape is moved on to match. Other
+ * code driving the hardware, eg copy protected loaders, still goes
+ * through do_mdv_tick.
+ */
+enum {
+  MDV_HLE_SECTOR,
+  MDV_HLE_READ,
+  MDV_HLE_VERIFY,
+  MDV_HLE_WRITE,
+};
+
+static const char* const mdvHleOps[] = { "sector", "read", "verify", "write",
+  NULL };
+
+/* QDOS vectors of the operations above, routine at word + 0x4000 */
+static const uint32_t mdvHleVectors[] = { 0x12a, 0x124, 0x128, 0x126 };
+
+/* microdrive checksums are 0x0f0f plus the bytes, low byte first */
+static void mdv_checksum(uint8_t* data, int len)
+{
+  uint16_t sum = 0x0f0f;
+
+  for (int i = 0; i < len; i++) {
+    sum += data[i];
+  }
+
+  data[len] = sum & 0xff;
+  data[len + 1] = sum >> 8;
+}
+
+/* put the tape at the start of a gap as do_mdv_tick would */
+static void mdv_hle_gap(struct mdvt* drive, mdvstate state)
+{
+  drive->mdvstate = state;
+  drive->mdvgapcnt = MDV_GAP_COUNT;
+  drive->idx = 0;
+  mdvgap = 1;
+  mdvrd = 0;
+}
+
+/* returns to +0 bad medium, +2 bad header or +4 with D7 the sector */
+static void mdv_hle_sector(const emulator_hle_t* hle, struct mdvt* drive)
+{
+  struct mdvsector* sect;
+
+  if (!drive->present) {
+    emulatorHleReturn(0);
+    return;
+  }
+
+  /* the header under the head, or the next once it has passed */
+  if (drive->mdvstate > MDV_PREAMBLE1) {
+    drive->sector = (drive->sector + 1) % drive->no_sectors;
+  }
+  mdv_hle_gap(drive, MDV_GAP2);
+
+  sect = mdv_sector(drive, drive->sector);
+  if (sect->header[0] != 0xff) {
+    emulatorHleReturn(2);
+    return;
+  }
+
+  emulatorHleSetReg(hle, 0, sect->header[1]);
+  emulatorHleReturn(4);
+}
+
+/* the data block of the sector whose header was just read */
+static void mdv_hle_block(const emulator_hle_t* hle, struct mdvt* drive)
+{
+  struct mdvsector* sect = mdv_sector(drive, drive->sector);
+  uint32_t addr = emulatorHleReg(hle, 0);
+  uint8_t buf[512];
+  unsigned int skip = 0;
+
+  switch (hle->op) {
+  case MDV_HLE_READ:
+    emulatorMemoryWrite(addr, sect->block, 512);
+    skip = 2;
+    break;
+  case MDV_HLE_VERIFY:
+    emulatorMemoryRead(addr, buf, 512);
+    if (memcmp(buf, sect->block, 512) == 0) {
+      skip = 2;
+    }
+    break;
+  case MDV_HLE_WRITE:
+    if (!drive->wrprot) {
+      sect->blockheader[0] = emulatorHleReg(hle, 1);
+      sect->blockheader[1] = emulatorHleReg(hle, 2);
+      mdv_checksum(sect->blockheader, 2);
+      emulatorMemoryRead(addr, sect->block, 512);
+      mdv_checksum(sect->block, 512);
+      mdv_mark_dirty(mdvnum, drive->sector);
+    }
+    break;
+  }
+
+  if (hle->op != MDV_HLE_WRITE) {
+    emulatorHleSetReg(hle, 1, sect->blockheader[0]);
+    emulatorHleSetReg(hle, 2, sect->blockheader[1]);
+  }
+  emulatorHleSetReg(hle, 0, addr + 512);
+
+  /* on to the gap before the next header */
+  drive->sector = (drive->sector + 1) % drive->no_sectors;
+  mdv_hle_gap(drive, MDV_GAP1);
+
+  emulatorHleReturn(skip);
+}
+
+static bool mdv_hle(const emulator_hle_t* hle)
+{
+  struct mdvt* drive;
+
+  if (!mdvmotor || (hle->unit && (hle->unit != (mdvnum + 1)))) {
+    return false;
+  }
+  drive = &mdrive[mdvnum];
+
+  if (hle->op == MDV_HLE_SECTOR) {
+    mdv_hle_sector(hle, drive);
+    return true;
+  }
+
+  /* only straight after a header, otherwise leave it to the ROM */
+  if (!drive->present || (drive->mdvstate < MDV_GAP2)
+      || (drive->mdvstate > MDV_DATA_PREAMBLE)) {
+    return false;
+  }
+
+  mdv_hle_block(hle, drive);
+  return true;
+}
+
+void qlayInitMdvHle(void)
+{
+  const uint8_t* rom = emulatorMemorySpace();
+
+  if (emulatorOptionDevCount("mdv-hle-pc")) {
+    emulatorHleInit("mdv-hle-pc", mdvHleOps, mdv_hle);
+    return;
+  }
+
+  if (!emulatorOptionInt("mdv-hle")) {
+    return;
+  }
+
+  for (int op = MDV_HLE_SECTOR; op <= MDV_HLE_WRITE; op++) {
+    uint32_t vector = mdvHleVectors[op];
+    emulator_hle_t hle = { 0 };
+
+    hle.pc = ((rom[vector] << 8) | rom[vector + 1]) + 0x4000;
+    hle.op = op;
+    hle.fn = mdv_hle;
+    if (op == MDV_HLE_SECTOR) {
+      hle.regs[0] = M68K_REG_D7;
+      hle.regCount = 1;
+    } else {
+      hle.regs[0] = M68K_REG_A1;
+      hle.regs[1] = M68K_REG_D1;
+      hle.regs[2] = M68K_REG_D2;
+      hle.regCount = 3;
+    }
+
+    emulatorHleAdd("mdv-hle", mdvHleOps, &hle);
+  }
+}
+
+void qlayIPCSnapshotSave(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_IPC);
+  emulatorSnapshotPut32(snap, IPC020);
+  emulatorSnapshotPut32(snap, IPCreturn);
+  emulatorSnapshotPut32(snap, IPCcnt);
+  emulatorSnapshotPut32(snap, IPCwfc);
+  emulatorSnapshotPut32(snap, IPCrcvd);
+  emulatorSnapshotPut32(snap, IPCpcmd);
+  emulatorSnapshotPut32(snap, IPCbaud);
+  emulatorSnapshotPut32(snap, IPCbeepParams);
+  emulatorSnapshotPut32(snap, IPCtestParams);
+  emulatorSnapshotPut32(snap, IPCtestval);
+  emulatorSnapshotPut8(snap, REG18021);
+  emulatorSnapshotPut32(snap, ser12oc);
+  emulatorSnapshotPut8(snap, qlayIPCBeeping);
+  emulatorSnapshotPutBytes(snap, BEEPpars, sizeof(BEEPpars));
+  emulatorSnapshotPut32(snap, IPCsercnt);
+  emulatorSnapshotPut32(snap, IPCchan);
+  for (int ch = 0; ch < 2; ch++) {
+    emulatorSnapshotPut32(snap, ser_rcv_1st[ch]);
+    emulatorSnapshotPut32(snap, ser_rcv_fill[ch]);
+    emulatorSnapshotPutRegion(snap, ser_rcv_buf[ch], SER_RCV_LEN);
+  }
+  emulatorSnapshotPut32(snap, ZXmode);
+  emulatorSnapshotPut32(snap, ZXbaud);
+  emulatorSnapshotPut32(snap, REG18020tx);
+  emulatorSnapshotPut32(snap, qlclkoff);
+  emulatorSnapshotEnd(snap);
+
+  emulatorSnapshotBegin(snap, EMU_SNAP_MDV);
+  emulatorSnapshotPut32(snap, mdvnum);
+  emulatorSnapshotPut8(snap, mdvwrite);
+  emulatorSnapshotPut8(snap, mdvmotor);
+  emulatorSnapshotPut32(snap, mdvghstate);
+  emulatorSnapshotPut32(snap, mdvdoub2);
+  emulatorSnapshotPut32(snap, mdvwra);
+  emulatorSnapshotPut32(snap, mdvgap);
+  emulatorSnapshotPut32(snap, mdvrd);
+  emulatorSnapshotPut8(snap, mdvtxfl);
+  emulatorSnapshotPut8(snap, mdverase);
+  emulatorSnapshotPut8(snap, PC_TRAK);
+  emulatorSnapshotPut8(snap, PC_TDATA);
+  emulatorSnapshotPut8(snap, mdvselect);
+  emulatorSnapshotPut8(snap, mdvselbit);
+
+  for (int i = 0; i < MDV_NUMOFDRIVES; i++) {
+    struct mdvt* drive = &mdrive[i];
+
+    emulatorSnapshotPut8(snap, drive->present);
+    if (!drive->present) {
+      continue;
+    }
+
+    emulatorSnapshotPut8(snap, drive->mdvwritten);
+    emulatorSnapshotPut32(snap, drive->no_sectors);
+    emulatorSnapshotPut32(snap, drive->sector);
+    emulatorSnapshotPut32(snap, drive->idx);
+    emulatorSnapshotPut32(snap, drive->mdvstate);
+    emulatorSnapshotPut32(snap, drive->mdvgapcnt);
+    mdv_decode_all(drive);
+    emulatorSnapshotPutRegion(snap, (uint8_t*)drive->data,
+        drive->no_sectors * sizeof(struct mdvsector));
+  }
+  emulatorSnapshotEnd(snap);
+}
+
+/*
+ * The cartridges must be the ones the snapshot was taken with, their
+ * contents are restored as the guest may have written to them since
+ * they were last saved.
+ */
+void qlayIPCSnapshotLoad(emulator_snapshot_t* snap)
+{
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_IPC)) {
+    return;
+  }
+
+  IPC020 = emulatorSnapshotGet32(snap);
+  IPCreturn = emulatorSnapshotGet32(snap);
+  IPCcnt = emulatorSnapshotGet32(snap);
+  IPCwfc = emulatorSnapshotGet32(snap);
+  IPCrcvd = emulatorSnapshotGet32(snap);
+  IPCpcmd = emulatorSnapshotGet32(snap);
+  IPCbaud = emulatorSnapshotGet32(snap);
+  IPCbeepParams = emulatorSnapshotGet32(snap) & 15;
+  IPCtestParams = emulatorSnapshotGet32(snap);
+  IPCtestval = emulatorSnapshotGet32(snap);
+  REG18021 = emulatorSnapshotGet8(snap);
+  ser12oc = emulatorSnapshotGet32(snap);
+  bool beeping = emulatorSnapshotGet8(snap);
+  emulatorSnapshotGetBytes(snap, BEEPpars, sizeof(BEEPpars));
+  IPCsercnt = emulatorSnapshotGet32(snap);
+  IPCchan = emulatorSnapshotGet32(snap) & 1;
+  for (int ch = 0; ch < 2; ch++) {
+    ser_rcv_1st[ch] = emulatorSnapshotGet32(snap) % SER_RCV_LEN;
+    ser_rcv_fill[ch] = emulatorSnapshotGet32(snap) % SER_RCV_LEN;
+    emulatorSnapshotGetRegion(snap, ser_rcv_buf[ch], SER_RCV_LEN);
+  }
+  ZXmode = emulatorSnapshotGet32(snap);
+  ZXbaud = emulatorSnapshotGet32(snap);
+  REG18020tx = emulatorSnapshotGet32(snap);
+  qlclkoff = emulatorSnapshotGet32(snap);
+
+  if (beeping) {
+    qlayIPCBeepSound(BEEPpars);
+  } else {
+    qlayIPCKillSound();
+  }
+
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_MDV)) {
+    return;
+  }
+
+  mdvnum = emulatorSnapshotGet32(snap);
+  mdvwrite = emulatorSnapshotGet8(snap);
+  mdvmotor = emulatorSnapshotGet8(snap);
+  mdvghstate = emulatorSnapshotGet32(snap);
+  mdvdoub2 = emulatorSnapshotGet32(snap);
+  mdvwra = emulatorSnapshotGet32(snap);
+  mdvgap = emulatorSnapshotGet32(snap);
+  mdvrd = emulatorSnapshotGet32(snap);
+  mdvtxfl = emulatorSnapshotGet8(snap);
+  mdverase = emulatorSnapshotGet8(snap);
+  PC_TRAK = emulatorSnapshotGet8(snap);
+  PC_TDATA = emulatorSnapshotGet8(snap);
+  mdvselect = emulatorSnapshotGet8(snap);
+  mdvselbit = emulatorSnapshotGet8(snap);
+
+  if (mdvmotor && ((mdvnum < 0) || (mdvnum >= MDV_NUMOFDRIVES))) {
+    emulatorSnapshotFail(snap, "bad MDV drive");
+    return;
+  }
+
+  for (int i = 0; i < MDV_NUMOFDRIVES; i++) {
+    struct mdvt* drive = &mdrive[i];
+
+    if (emulatorSnapshotGet8(snap) != drive->present) {
+      emulatorSnapshotFail(snap, "MDV cartridges differ from snapshot");
+      return;
+    }
+
+    if (!drive->present) {
+      continue;
+    }
+
+    drive->mdvwritten = emulatorSnapshotGet8(snap);
+    if ((int)emulatorSnapshotGet32(snap) != drive->no_sectors) {
+      emulatorSnapshotFail(snap, "MDV cartridges differ from snapshot");
+      return;
+    }
+    drive->sector = emulatorSnapshotGet32(snap) % drive->no_sectors;
+    drive->idx = emulatorSnapshotGet32(snap);
+    drive->mdvstate = emulatorSnapshotGet32(snap);
+    drive->mdvgapcnt = emulatorSnapshotGet32(snap);
+    emulatorSnapshotGetRegion(snap, (uint8_t*)drive->data,
+        drive->no_sectors * sizeof(struct mdvsector));
+
+    /* the file may hold later writes, save it as the snapshot has it */
+    SDL_memset(drive->decoded, 0xff, sizeof(drive->decoded));
+    SDL_memset(drive->dirty, 0xff, sizeof(drive->dirty));
+    if (!drive->wrprot) {
+      drive->mdvwritten = true;
+    }
+  }
+
+  if (mdvmotor) {
+    if (qlay_turbo_load) {
+      SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "0");
+    }
+    qlayStartMdvSound();
+  } else {
+    if (qlay_turbo_load) {
+      SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "50");
+    }
+    qlayStopMdvSound();
+  }
+}
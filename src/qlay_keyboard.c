@@ -6,6 +6,7 @@
 
 #include <SDL3/SDL.h>
 
+#include "emulator_keyboard.h"
 #include "emulator_trace.h"
 #include "qlay_hooks.h"
 #include "qlay_keyboard.h"
@@ -194,3 +195,32 @@ void emulatorProcessKey(int keysym, __attribute__((unused)) int scancode,
     }
   }
 }
+
+/*
+ * Only the codes queued for the guest are kept, the host's keys held
+ * down right now stay as they are so nothing sticks after a restore.
+ */
+void emulatorKeyboardSnapshotSave(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_KEYBOARD);
+  emulatorSnapshotPut32(snap, utarray_len(qlayKeyBuffer));
+  for (unsigned int i = 0; i < utarray_len(qlayKeyBuffer); i++) {
+    emulatorSnapshotPut32(snap, *(int*)utarray_eltptr(qlayKeyBuffer, i));
+  }
+  emulatorSnapshotEnd(snap);
+}
+
+void emulatorKeyboardSnapshotLoad(emulator_snapshot_t* snap)
+{
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_KEYBOARD)) {
+    return;
+  }
+
+  uint32_t count = emulatorSnapshotGet32(snap);
+
+  utarray_clear(qlayKeyBuffer);
+  for (uint32_t i = 0; (i < count) && !emulatorSnapshotFailed(snap); i++) {
+    int key = emulatorSnapshotGet32(snap);
+    utarray_push_back(qlayKeyBuffer, &key);
+  }
+}
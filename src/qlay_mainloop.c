@@ -7,41 +7,61 @@
 #include <SDL3/SDL.h>
 #include <stdint.h>
 
+#include "emulator_bench.h"
 #include "emulator_events.h"
 #include "emulator_files.h"
 #include "emulator_hardware.h"
+#include "emulator_keyboard.h"
 #include "emulator_memory.h"
 #include "emulator_options.h"
 #include "emulator_screen.h"
+#include "emulator_snapshot.h"
 #include "m68k.h"
 #include "qlay_disk.h"
 #include "qlay_hooks.h"
 #include "qlay_io.h"
 #include "qlay_keyboard.h"
 #include "qlay_qlsd.h"
+#include "qlay_scheduler.h"
 #include "qlay_sound.h"
-
-#define MDV_CYCLES 230
-#define FIFTYHZ_CYCLES 150000
-#define POINTONEMS_CYCLES 750
+#include "spi_sdcard.h"
 
 typedef struct {
-  uint64_t cyclesNow;
-  uint64_t cyclesThen;
-  uint64_t cyclesMdv;
   uint64_t frameCount;
+  bool frameDone;
 } emulator_state_t;
 
-int msClk = 0;
+static emulator_state_t* qlayState = NULL;
 
 unsigned int extraCycles;
 
-uint64_t cyclesNow = 0;
-bool doIrq = false;
-
 uint64_t cycles(void)
 {
-  return cyclesNow / 16;
+  return qlaySchedulerNow() / 16;
+}
+
+static void qlayFrameEvent(void)
+{
+  int bucket = emulatorBenchSwitch(EMU_BENCH_RENDER);
+  emulatorUpdatePixelBuffer();
+  emulatorRenderScreen();
+  emulatorBenchSwitch(bucket);
+  emulatorBenchFrame();
+  emulatorBootSnapshotFrame();
+
+  EMU_PC_INTR |= PC_INTRF;
+
+  m68k_set_irq(2);
+
+  qlayState->frameCount++;
+  qlayState->frameDone = true;
+}
+
+// update the RTC register
+static void qlayRtcEvent(void)
+{
+  EMU_PC_CLOCK++;
+  qlayMdvIdle();
 }
 
 void* emulatorInitEmulation(void)
@@ -50,6 +70,8 @@ void* emulatorInitEmulation(void)
   m68k_init();
   m68k_pulse_reset();
 
+  qlaySchedulerInit();
+
   qlayInitSound();
   qlayInitIPCSound();
   qlayInitAYSound();
@@ -59,40 +81,55 @@ void* emulatorInitEmulation(void)
   qlayInitialiseTime();
   qlayInitialiseQsound();
   qlayQLSDInitialise();
+  qlayInitialiseQLSDHle();
+  qlayInitMdvHle();
+
+  qlayState = calloc(1, sizeof(emulator_state_t));
 
-  emulator_state_t* emu_state = calloc(1, sizeof(emulator_state_t));
-  return emu_state;
+  qlaySchedulerSetHandler(QLAY_EVENT_FRAME, qlayFrameEvent);
+  qlaySchedulerSetHandler(QLAY_EVENT_RTC, qlayRtcEvent);
+  qlayScheduleEventAt(QLAY_EVENT_FRAME, QLAY_FRAME_CYCLES,
+      QLAY_FRAME_CYCLES);
+  qlayScheduleEventAt(QLAY_EVENT_RTC, QLAY_RTC_CYCLES, QLAY_RTC_CYCLES);
+
+  return qlayState;
+}
+
+void emulatorExitEmulation(void)
+{
+  qlayMdvQuit();
+  exit_qldisk();
 }
 
 bool emulatorInteration(void* state)
 {
   emulator_state_t* emu_state = (emulator_state_t*)state;
 
-  while ((emu_state->cyclesNow - emu_state->cyclesThen) < FIFTYHZ_CYCLES) {
-    extraCycles = 0;
-    emu_state->cyclesNow += m68k_execute(1) + extraCycles;
-
-    if ((emu_state->cyclesNow - emu_state->cyclesMdv) > MDV_CYCLES) {
-      do_mdv_tick();
-
-      emu_state->cyclesMdv += MDV_CYCLES;
-    }
+  emu_state->frameDone = false;
+  while (!emu_state->frameDone) {
+    qlaySchedulerRun();
   }
 
-  emulatorUpdatePixelBuffer();
-  emulatorRenderScreen();
-
-  EMU_PC_INTR |= PC_INTRF;
-
-  m68k_set_irq(2);
+  return 0;
+}
 
-  emu_state->cyclesThen += FIFTYHZ_CYCLES;
+void emulatorMachineSave(emulator_snapshot_t* snap)
+{
+  emulatorHardwareSnapshotSave(snap);
+  qlayIPCSnapshotSave(snap);
+  emulatorKeyboardSnapshotSave(snap);
+  qlaySchedulerSnapshotSave(snap);
+  card_snapshot_save(snap);
+}
 
-  // update the RTC register
-  emu_state->frameCount++;
-  if (emu_state->frameCount % 50 == 0) {
-    EMU_PC_CLOCK++;
-  }
+void emulatorMachineLoad(emulator_snapshot_t* snap)
+{
+  emulatorHardwareSnapshotLoad(snap);
+  qlayIPCSnapshotLoad(snap);
+  emulatorKeyboardSnapshotLoad(snap);
+  qlaySchedulerSnapshotLoad(snap);
+  card_snapshot_load(snap);
 
-  return 0;
+  // the interrupt line is never lowered once the first frame raises it
+  m68k_set_irq(2);
 }
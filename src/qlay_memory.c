@@ -21,6 +21,9 @@ static unsigned int qlayMemSize = 0;
 static unsigned int qlayRamSize = 0;
 static unsigned int qlayRomLow = 0;
 
+emulator_page_t emulatorPages[EMU_PAGE_COUNT];
+uint32_t emulatorWriteCount = 0;
+
 typedef struct {
   char* romname;
   Uint32 romaddr;
@@ -41,6 +44,11 @@ Uint8* emulatorScreenSpace(void)
   return NULL;
 }
 
+size_t emulatorMemorySize(void)
+{
+  return qlayMemSize;
+}
+
 int emulatorInitMemory(void)
 {
   int i;
@@ -165,10 +173,54 @@ int emulatorInitMemory(void)
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Initialized RAM %uk\n",
       (qlayRamSize / 1024) - 128);
 
+  emulatorMemoryMapUpdate();
+
   return 0;
 }
 
-unsigned int m68k_read_memory_8(unsigned int address)
+/*
+ * Rebuild the page table, called whenever QL-SD or qsound change which
+ * pages have to be decoded in full.
+ */
+void emulatorMemoryMapUpdate(void)
+{
+  SDL_memset(emulatorPages, 0, sizeof(emulatorPages));
+
+  for (Uint32 page = 0; page < (qlayMemSize >> EMU_PAGE_SHIFT); page++) {
+    Uint32 base = page << EMU_PAGE_SHIFT;
+    Uint32 end = base + EMU_PAGE_SIZE;
+    emulator_page_t* entry = &emulatorPages[page];
+
+    if (end <= QL_INTERNAL_IO) {
+      // system rom, QL-SD registers live in the top of it
+      if (!QLSDEnabled) {
+        entry->read = &qlayMemSpace[base];
+      }
+    } else if ((base >= KB(128)) && (end <= qlayRamSize)) {
+      entry->read = &qlayMemSpace[base];
+      entry->write = &qlayMemSpace[base];
+
+      if (base < KB(256)) {
+        entry->wait = CONTENTION_CYCLES;
+      }
+
+      if (base == 0x20000) {
+        entry->dirty = &emulatorScreenDirty[EMU_DIRTY_QL / 32];
+      }
+    } else if (base >= qlayRomLow) {
+      entry->read = &qlayMemSpace[base];
+    }
+  }
+
+  if (qsound_enabled) {
+    for (Uint32 address = qsound_addr; address < (qsound_addr + 4);
+        address++) {
+      emulatorPages[address >> EMU_PAGE_SHIFT].write = NULL;
+    }
+  }
+}
+
+static unsigned int qlayReadSlow8(unsigned int address)
 {
   if ((address >= QL_INTERNAL_IO) && address < (QL_INTERNAL_IO + QL_INTERNAL_IO_SIZE)) {
     return qlHardwareRead8(address);
@@ -179,7 +231,7 @@ unsigned int m68k_read_memory_8(unsigned int address)
     return qlHardwareRead8(address);
   }
 
-  if ((QLAY_NFA_IO) && address < (QLAY_NFA_IO + QLAY_NFA_IO_SIZE)) {
+  if ((address >= QLAY_NFA_IO) && address < (QLAY_NFA_IO + QLAY_NFA_IO_SIZE)) {
     return rdnfa(address);
   }
 
@@ -199,9 +251,30 @@ unsigned int m68k_read_memory_8(unsigned int address)
   return qlayMemSpace[address];
 }
 
+unsigned int m68k_read_memory_8(unsigned int address)
+{
+  const emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+
+  if (page->read) {
+    extraCycles += page->wait;
+    return page->read[address & EMU_PAGE_MASK];
+  }
+
+  return qlayReadSlow8(address);
+}
+
 unsigned int m68k_read_memory_16(unsigned int address)
 {
+  const emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+  unsigned int offset = address & EMU_PAGE_MASK;
+
   extraCycles += 4;
+
+  if (page->read && (offset <= (EMU_PAGE_SIZE - 2))) {
+    extraCycles += page->wait * 2;
+    return SDL_Swap16BE(*(const Uint16*)&page->read[offset]);
+  }
+
   return m68k_read_memory_8(address) << 8 | m68k_read_memory_8(address + 1);
 }
 
@@ -216,7 +289,16 @@ unsigned int m68k_read_disassembler_16(unsigned int address)
 
 unsigned int m68k_read_memory_32(unsigned int address)
 {
+  const emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+  unsigned int offset = address & EMU_PAGE_MASK;
+
   extraCycles += 12;
+
+  if (page->read && (offset <= (EMU_PAGE_SIZE - 4))) {
+    extraCycles += page->wait * 4;
+    return SDL_Swap32BE(*(const Uint32*)&page->read[offset]);
+  }
+
   return m68k_read_memory_8(address) << 24 | m68k_read_memory_8(address + 1) << 16 | m68k_read_memory_8(address + 2) << 8 | m68k_read_memory_8(address + 3);
 }
 
@@ -229,7 +311,7 @@ unsigned int m68k_read_disassembler_32(unsigned int address)
   return SDL_Swap32BE(*(Uint32*)&qlayMemSpace[address]);
 }
 
-void m68k_write_memory_8(unsigned int address, unsigned int value)
+static void qlayWriteSlow8(unsigned int address, unsigned int value)
 {
   if (address < QL_INTERNAL_IO) {
     return;
@@ -261,16 +343,69 @@ void m68k_write_memory_8(unsigned int address, unsigned int value)
   qlayMemSpace[address] = value;
 }
 
+void m68k_write_memory_8(unsigned int address, unsigned int value)
+{
+  emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+
+  emulatorWriteCount++;
+
+  if (page->dirty) {
+    EMU_PAGE_MARK_DIRTY(page, address & EMU_PAGE_MASK);
+  }
+
+  if (page->write) {
+    extraCycles += page->wait;
+    page->write[address & EMU_PAGE_MASK] = value;
+    return;
+  }
+
+  qlayWriteSlow8(address, value);
+}
+
 void m68k_write_memory_16(unsigned int address, unsigned int value)
 {
+  emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+  unsigned int offset = address & EMU_PAGE_MASK;
+
+  emulatorWriteCount++;
+
   extraCycles += 4;
+
+  if (page->write && (offset <= (EMU_PAGE_SIZE - 2))) {
+    if (page->dirty) {
+      EMU_PAGE_MARK_DIRTY(page, offset);
+      EMU_PAGE_MARK_DIRTY(page, offset + 1);
+    }
+
+    extraCycles += page->wait * 2;
+    *(Uint16*)&page->write[offset] = SDL_Swap16BE(value);
+    return;
+  }
+
   m68k_write_memory_8(address + 0, (value >> 8) & 0xFF);
   m68k_write_memory_8(address + 1, (value >> 0) & 0xFF);
 }
 
 void m68k_write_memory_32(unsigned int address, unsigned int value)
 {
+  emulator_page_t* page = &emulatorPages[address >> EMU_PAGE_SHIFT];
+  unsigned int offset = address & EMU_PAGE_MASK;
+
+  emulatorWriteCount++;
+
   extraCycles += 12;
+
+  if (page->write && (offset <= (EMU_PAGE_SIZE - 4))) {
+    if (page->dirty) {
+      EMU_PAGE_MARK_DIRTY(page, offset);
+      EMU_PAGE_MARK_DIRTY(page, offset + 3);
+    }
+
+    extraCycles += page->wait * 4;
+    *(Uint32*)&page->write[offset] = SDL_Swap32BE(value);
+    return;
+  }
+
   m68k_write_memory_8(address + 0, (value >> 24) & 0xFF);
   m68k_write_memory_8(address + 1, (value >> 16) & 0xFF);
   m68k_write_memory_8(address + 2, (value >> 8) & 0xFF);
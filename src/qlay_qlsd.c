@@ -7,25 +7,28 @@
 #include <SDL3/SDL.h>
 
 #include "emulator_logging.h"
+#include "emulator_memory.h"
 #include "emulator_options.h"
 #include "spi_sdcard.h"
 
-SDL_IOStream* sd1Stream = NULL;
-SDL_IOStream* sd2Stream = NULL;
+emulator_sdimage_t* sd1Image = NULL;
+emulator_sdimage_t* sd2Image = NULL;
 bool QLSDEnabled = false;
 
 bool qlayQLSDInitialise(void)
 {
   if (emulatorOptionInt("qlsd")) {
     QLSDEnabled = true;
+    emulatorMemoryMapUpdate();
   }
 
   const char* diskName = emulatorOptionString("sd1");
   if (!diskName || (strlen(diskName) == 0)) {
     SDL_LogDebug(QLAY_LOG_DISK, "No SD card specified for SD1");
   } else {
-    sd1Stream = SDL_IOFromFile(diskName, "r+b");
-    if (sd1Stream == NULL) {
+    sd1Image = sdImageOpen(diskName,
+        emulatorOptionString("sd1-overlay"));
+    if (sd1Image == NULL) {
       SDL_LogError(QLAY_LOG_DISK,
           "Failed to open SD1 image: %s %s",
           diskName, SDL_GetError());
@@ -37,8 +40,9 @@ bool qlayQLSDInitialise(void)
   if (!diskName || (strlen(diskName) == 0)) {
     SDL_LogDebug(QLAY_LOG_DISK, "No SD card specified for SD2");
   } else {
-    sd2Stream = SDL_IOFromFile(diskName, "r+b");
-    if (sd2Stream == NULL) {
+    sd2Image = sdImageOpen(diskName,
+        emulatorOptionString("sd2-overlay"));
+    if (sd2Image == NULL) {
       SDL_LogError(QLAY_LOG_DISK,
           "Failed to open SD2 card: %s %s", diskName,
           SDL_GetError());
@@ -46,7 +50,7 @@ bool qlayQLSDInitialise(void)
     }
   }
 
-  card_initialise(sd1Stream, sd2Stream);
+  card_initialise(sd1Image, sd2Image);
 
   return true;
 }
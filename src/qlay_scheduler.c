@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2026 Graeme Gregory
+ *
+ * SPDX: GPL-2.0-only
+ */
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "emulator_bench.h"
+#include "emulator_idle.h"
+#include "emulator_logging.h"
+#include "emulator_mainloop.h"
+#include "emulator_sdimage.h"
+#include "m68k.h"
+#include "qlay_scheduler.h"
+
+/*
+ * Cycle stamped event queue for the QL main loop. The CPU is run in
+ * timeslices that end exactly on the next pending event, so there is no
+ * per instruction polling of the device timers. Only a handful of event
+ * sources exist so a flat table scanned in event order is all we need.
+ */
+
+typedef struct {
+  bool pending;
+  uint64_t when;
+  uint64_t period;
+  qlay_event_handler_t handler;
+} qlay_event_entry_t;
+
+static qlay_event_entry_t qlayEvents[QLAY_EVENT_MAX];
+
+// cycle count at the start of the current timeslice
+static uint64_t qlayCycles = 0;
+static bool qlayInSlice = false;
+
+void qlaySchedulerInit(void)
+{
+  SDL_memset(qlayEvents, 0, sizeof(qlayEvents));
+  qlayCycles = 0;
+  qlayInSlice = false;
+}
+
+void qlaySchedulerSetHandler(qlay_event_t event, qlay_event_handler_t handler)
+{
+  qlayEvents[event].handler = handler;
+}
+
+uint64_t qlaySchedulerNow(void)
+{
+  if (qlayInSlice) {
+    return qlayCycles + m68k_cycles_run() + extraCycles;
+  }
+
+  return qlayCycles;
+}
+
+/*
+ * Musashi's m68k_end_timeslice() also rewinds the count of cycles run,
+ * so shorten the slice with m68k_modify_timeslice() instead, this keeps
+ * the return value of m68k_execute() honest and lets the slice finish
+ * on the new deadline rather than immediately.
+ */
+static void qlayPullInDeadline(uint64_t when)
+{
+  uint64_t now = qlaySchedulerNow();
+  int remaining = m68k_cycles_remaining();
+  int wanted = 0;
+
+  if (when > now) {
+    wanted = (int)SDL_min(when - now, (uint64_t)SDL_MAX_SINT32);
+  }
+
+  if (wanted < remaining) {
+    m68k_modify_timeslice(wanted - remaining);
+  }
+}
+
+void qlayScheduleEventAt(qlay_event_t event, uint64_t when, uint64_t period)
+{
+  qlayEvents[event].pending = true;
+  qlayEvents[event].when = when;
+  qlayEvents[event].period = period;
+
+  if (qlayInSlice) {
+    qlayPullInDeadline(when);
+  }
+}
+
+void qlayScheduleEvent(qlay_event_t event, uint64_t delay)
+{
+  qlayScheduleEventAt(event, qlaySchedulerNow() + delay, 0);
+}
+
+void qlayCancelEvent(qlay_event_t event)
+{
+  qlayEvents[event].pending = false;
+}
+
+bool qlayEventPending(qlay_event_t event)
+{
+  return qlayEvents[event].pending;
+}
+
+uint64_t qlaySchedulerNextEvent(void)
+{
+  uint64_t next = UINT64_MAX;
+
+  for (int i = 0; i < QLAY_EVENT_MAX; i++) {
+    if (qlayEvents[i].pending && (qlayEvents[i].when < next)) {
+      next = qlayEvents[i].when;
+    }
+  }
+
+  return next;
+}
+
+static int qlayNextDueEvent(void)
+{
+  int due = -1;
+
+  for (int i = 0; i < QLAY_EVENT_MAX; i++) {
+    if (!qlayEvents[i].pending || (qlayEvents[i].when > qlayCycles)) {
+      continue;
+    }
+
+    if ((due < 0) || (qlayEvents[i].when < qlayEvents[due].when)) {
+      due = i;
+    }
+  }
+
+  return due;
+}
+
+void qlaySchedulerRun(void)
+{
+  uint64_t next = qlaySchedulerNextEvent();
+
+  if (next == UINT64_MAX) {
+    next = qlayCycles + QLAY_FRAME_CYCLES;
+  }
+
+  if (next > qlayCycles) {
+    int slice = (int)SDL_min(next - qlayCycles, (uint64_t)SDL_MAX_SINT32);
+
+    extraCycles = 0;
+    qlayInSlice = true;
+    int bucket = emulatorBenchSwitch(EMU_BENCH_CPU);
+    int ran = m68k_execute(slice);
+    emulatorBenchSwitch(bucket);
+    qlayInSlice = false;
+
+    qlayCycles += ran + extraCycles;
+
+    // nothing changes for an idle guest until the next event
+    if (emulatorIdleTake()) {
+      uint64_t due = qlaySchedulerNextEvent();
+
+      sdImageFlushAll();
+
+      if ((due != UINT64_MAX) && (due > qlayCycles)) {
+        qlayCycles = due;
+      }
+    }
+  }
+
+  int event;
+  while ((event = qlayNextDueEvent()) >= 0) {
+    qlay_event_entry_t* entry = &qlayEvents[event];
+
+    if (entry->period) {
+      entry->when += entry->period;
+    } else {
+      entry->pending = false;
+    }
+
+    if (entry->handler) {
+      int bucket = emulatorBenchSwitch(EMU_BENCH_DEVICE);
+      entry->handler();
+      emulatorBenchSwitch(bucket);
+    } else {
+      SDL_LogError(QLAY_LOG_HW, "No handler for event %d", event);
+    }
+  }
+}
+
+// handlers are fixed at init so only the timing is kept
+void qlaySchedulerSnapshotSave(emulator_snapshot_t* snap)
+{
+  emulatorSnapshotBegin(snap, EMU_SNAP_SCHEDULER);
+  emulatorSnapshotPut64(snap, qlayCycles);
+  emulatorSnapshotPut32(snap, QLAY_EVENT_MAX);
+  for (int i = 0; i < QLAY_EVENT_MAX; i++) {
+    emulatorSnapshotPut8(snap, qlayEvents[i].pending);
+    emulatorSnapshotPut64(snap, qlayEvents[i].when);
+    emulatorSnapshotPut64(snap, qlayEvents[i].period);
+  }
+  emulatorSnapshotEnd(snap);
+}
+
+void qlaySchedulerSnapshotLoad(emulator_snapshot_t* snap)
+{
+  if (!emulatorSnapshotFind(snap, EMU_SNAP_SCHEDULER)) {
+    return;
+  }
+
+  qlayCycles = emulatorSnapshotGet64(snap);
+  if (emulatorSnapshotGet32(snap) != QLAY_EVENT_MAX) {
+    emulatorSnapshotFail(snap, "bad scheduler chunk");
+    return;
+  }
+
+  for (int i = 0; i < QLAY_EVENT_MAX; i++) {
+    qlayEvents[i].pending = emulatorSnapshotGet8(snap);
+    qlayEvents[i].when = emulatorSnapshotGet64(snap);
+    qlayEvents[i].period = emulatorSnapshotGet64(snap);
+  }
+}
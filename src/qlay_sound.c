@@ -9,6 +9,7 @@
 #include <stdint.h>
 
 #include "ayemu.h"
+#include "emulator_bench.h"
 #include "emulator_logging.h"
 #include "emulator_options.h"
 #include "qlay_io.h"
@@ -259,6 +260,12 @@ static SDL_AudioSpec audio_spec;
 
 bool qlayInitSound(void)
 {
+  // the null audio backend, streams are not created without a device
+  if (emulatorBenchEnabled()) {
+    SDL_LogDebug(QLAY_LOG_SOUND, "Audio disabled for benchmark");
+    return true;
+  }
+
   audio_dev = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
   if (!audio_dev) {
     SDL_LogError(QLAY_LOG_SOUND, "Couldn't open audio device: %s",
@@ -313,6 +320,10 @@ bool qlayInitMdvSound(void)
   int silenceVal = SDL_GetSilenceValueForFormat(SDL_AUDIO_U8);
   SDL_memset(mdv_silence, silenceVal, 256);
 
+  if (!audio_dev) {
+    return false;
+  }
+
   double gain = emulatorOptionInt("mdvvol");
   if (gain < 0.0) {
     gain = 0.0;
@@ -480,6 +491,10 @@ bool qlayInitIPCSound(void)
     return false;
   }
 
+  if (!audio_dev) {
+    return false;
+  }
+
   ipc_audio_stream = SDL_CreateAudioStream(&spec, &audio_spec);
   if (!ipc_audio_stream) {
     SDL_LogError(QLAY_LOG_SOUND,
@@ -532,6 +547,7 @@ void PackIPCCommand(Uint8* arg, Uint8* pack)
 void qlayIPCBeepSound(Uint8* arg)
 {
   Uint8 params[MAX_IPC_PARAMS] = { 0 }; // Init to all 0
+  int bucket = emulatorBenchSwitch(EMU_BENCH_AUDIO);
   PackIPCCommand(arg, params);
 
   // Find correct param structure
@@ -573,6 +589,7 @@ void qlayIPCBeepSound(Uint8* arg)
 
   // Always unpause the sound here, in case the callback has paused itself
   SDL_ResumeAudioStreamDevice(ipc_audio_stream);
+  emulatorBenchSwitch(bucket);
 }
 
 void qlayIPCKillSound(void)
@@ -887,6 +904,10 @@ bool qlayInitAYSound(void)
   ayemu_set_chip_freq(&ay, 750000);
   ayemu_reset(&ay);
 
+  if (!audio_dev) {
+    return false;
+  }
+
   ay_audio_stream = SDL_CreateAudioStream(&spec, &audio_spec);
   if (!ay_audio_stream) {
     SDL_LogError(QLAY_LOG_SOUND,
@@ -927,8 +948,12 @@ bool qlayInitAYSound(void)
 
 void qlaySetAYRegister(Uint8 regNum, Uint8 regVal)
 {
+  int bucket = emulatorBenchSwitch(EMU_BENCH_AUDIO);
+
   SDL_LockMutex(ay_mutex);
   ay_regs[regNum] = regVal;
   ayemu_set_regs(&ay, ay_regs);
   SDL_UnlockMutex(ay_mutex);
+
+  emulatorBenchSwitch(bucket);
 }